@@ -101,6 +101,12 @@ CREATE TABLE IF NOT EXISTS posts (
     updated_at   TIMESTAMP   NOT NULL
 );
 
+-- Content hash of each stored post, re-synced rows that hash the same aren't rewritten
+CREATE TABLE IF NOT EXISTS post_hashes (
+    id   INTEGER PRIMARY KEY,
+    hash BIGINT  NOT NULL
+);
+
 CREATE TABLE IF NOT EXISTS post_versions (
     id           INTEGER   PRIMARY KEY,
     post_id      INTEGER   NOT NULL,
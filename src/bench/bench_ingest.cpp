@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <iostream>
+#include <format>
+#include <stdexcept>
+#include <chrono>
+#include <list>
+#include <string>
+
+#include <tclap/CmdLine.h>
+#include <pqxx/pqxx>
+
+#include <env.hpp>
+#include <logging.hpp>
+
+#include "danbooru.hpp"
+#include "database.hpp"
+#include "database_pool.hpp"
+#include "tasks/fetch_posts.hpp"
+
+#include "fixtures.hpp"
+#include "mock_server.hpp"
+
+namespace detail {
+    /* putenv keeps the pointer, so the strings have to outlive it */
+    static std::list<std::string> env_storage;
+
+    static void set_env(std::string_view key, std::string_view value, bool overwrite) {
+        if (!overwrite && util::environment::contains(std::string { key })) {
+            return;
+        }
+
+        std::string& entry = env_storage.emplace_back(std::format("{}={}", key, value));
+        if (putenv(entry.data()) != 0) {
+            throw std::runtime_error { std::format("Failed to set {}", key) };
+        }
+    }
+
+    [[nodiscard]] static double seconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double>(duration).count();
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        TCLAP::CmdLine cmd { "Ingest posts from a local mock server into Postgres and report throughput" };
+
+        cmd.add(util::environment::arg());
+
+        TCLAP::SwitchArg truncate { "", "truncate", "Required, acknowledges that the posts, tags and metadata tables are emptied first" };
+        TCLAP::ValueArg<std::string> fixture_dir { "f", "fixtures", "Directory with posts.json, tags.json and post_versions.json", false, "", "DIR" };
+        TCLAP::ValueArg<size_t> posts { "", "posts", "Posts to generate", false, 20000, "COUNT" };
+        TCLAP::ValueArg<size_t> tags { "", "tags", "Tags to generate", false, 5000, "COUNT" };
+        TCLAP::ValueArg<uint32_t> seed { "", "seed", "Generator seed", false, 1, "SEED" };
+        TCLAP::ValueArg<int64_t> latency { "", "latency", "Added latency per request", false, 0, "MS" };
+        TCLAP::ValueArg<int64_t> jitter { "", "jitter", "Random extra latency, up to", false, 0, "MS" };
+        TCLAP::ValueArg<double> error_rate { "", "error-rate", "Fraction of requests that fail", false, 0, "RATE" };
+        TCLAP::ValueArg<int> error_status { "", "error-status", "Status code of failed requests", false, 503, "STATUS" };
+        TCLAP::ValueArg<uint64_t> rate_limit { "", "rate-limit", "Client requests per second", false, 1000, "RATE" };
+        TCLAP::MultiSwitchArg verbose { "v", "verbose", "Verbose output" };
+
+        cmd.add(truncate);
+        cmd.add(fixture_dir);
+        cmd.add(posts);
+        cmd.add(tags);
+        cmd.add(seed);
+        cmd.add(latency);
+        cmd.add(jitter);
+        cmd.add(error_rate);
+        cmd.add(error_status);
+        cmd.add(rate_limit);
+        cmd.add(verbose);
+        cmd.parse(argc, argv);
+        util::environment::parse();
+
+        if (!truncate.getValue()) {
+            std::println(std::cerr, "Refusing to run without --truncate, the benchmark empties the posts, tags and metadata tables");
+            return EXIT_FAILURE;
+        }
+
+        util::logging::setup();
+
+        if (int verbosity = verbose.getValue()) {
+            spdlog::set_level(verbosity == 1 ? spdlog::level::debug : spdlog::level::trace);
+        }
+
+        bench::fixtures data = fixture_dir.isSet()
+            ? bench::fixtures::load(fixture_dir.getValue())
+            : bench::fixtures::generate(posts.getValue(), tags.getValue(), seed.getValue());
+
+        size_t expected = data.posts.size();
+
+        bench::mock_server server { std::move(data), {
+            .latency = std::chrono::milliseconds(latency.getValue()),
+            .jitter = std::chrono::milliseconds(jitter.getValue()),
+            .error_rate = error_rate.getValue(),
+            .error_status = error_status.getValue(),
+        } };
+
+        int port = server.start("127.0.0.1", 0);
+
+        /* Everything else, including the database, comes from the usual environment */
+        detail::set_env("DANBOORU_URL", std::format("http://127.0.0.1:{}", port), true);
+        detail::set_env("DANBOORU_RATE_LIMIT", std::to_string(rate_limit.getValue()), true);
+        detail::set_env("DANBOORU_LOGIN", "bench", false);
+        detail::set_env("DANBOORU_API_KEY", "bench", false);
+
+        database::pool pool { util::environment::get_or_default<size_t>("DATABASE_POOL_SIZE", 8) };
+        database::tag_dictionary dictionary;
+
+        {
+            auto db = pool.acquire();
+            auto tx = db->work();
+            tx.exec0("TRUNCATE posts, post_hashes, media_asset_variants, media_assets, tags, metadata");
+            tx.commit();
+
+            dictionary.warm(*db);
+        }
+
+        danbooru::api booru;
+
+        uint64_t requests_before = server.requests();
+
+        auto begin = std::chrono::steady_clock::now();
+        tasks::ingest_stats stats = tasks::ingest_posts(std::stop_token {}, booru, dictionary, pool);
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+
+        uint64_t requests = server.requests() - requests_before;
+
+        server.stop();
+
+        if (stats.posts != expected) {
+            spdlog::warn("Ingested {} posts, expected {}", stats.posts, expected);
+        }
+
+        double total = detail::seconds(elapsed);
+
+        std::println("posts:    {} in {} pages, {} commits, {:.3f} s", stats.posts, stats.pages, stats.commits, total);
+        std::println("posts/s:  {:.1f}", stats.posts / total);
+        std::println("req/s:    {:.1f} ({} requests, {} injected errors)", requests / total, requests, server.errors());
+
+        for (auto [name, duration] : {
+            std::pair { "fetch", stats.fetch },
+            std::pair { "resolve", stats.resolve },
+            std::pair { "insert", stats.insert },
+            std::pair { "commit", stats.commit },
+        }) {
+            std::println("{:<9} {:.3f} s ({:.1f}%)", std::format("{}:", name), detail::seconds(duration), 100. * detail::seconds(duration) / total);
+        }
+
+        /* A queue that's mostly full points at the stage after it, one that's mostly empty at the stage before */
+        for (auto [name, queue] : {
+            std::pair { "pages", stats.pages_queue },
+            std::pair { "rows", stats.rows_queue },
+        }) {
+            std::println("{:<9} {:.1f}/{} avg, {} max, full {:.3f} s, empty {:.3f} s", std::format("{}:", name),
+                queue.average_occupancy(), queue.capacity, queue.max_occupancy,
+                detail::seconds(queue.full), detail::seconds(queue.empty));
+        }
+
+        booru.log_stats();
+        dictionary.log_memory();
+        pool.log_stats();
+
+    } catch (const std::exception& e) {
+        std::println(std::cerr, "Exception: {}", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <iostream>
+#include <format>
+#include <stdexcept>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <array>
+#include <optional>
+
+#include <tclap/CmdLine.h>
+
+#include "danbooru_defs.hpp"
+
+using namespace danbooru;
+
+namespace detail {
+    using namespace std::chrono;
+
+    [[nodiscard]] static double to_seconds(steady_clock::duration elapsed) {
+        return duration<double>(elapsed).count();
+    }
+
+    /* A random instant between 1970 and 2100 as the API would send it, in some random time zone */
+    [[nodiscard]] static std::string random_timestamp(std::mt19937_64& rng) {
+        std::uniform_int_distribution<int64_t> instant { 0, (sys_days { year { 2100 } / 1 / 1 } - sys_days {}).count() * 86'400'000 };
+        std::uniform_int_distribution<int> offset_minutes { -(23 * 60 + 59), 23 * 60 + 59 };
+
+        sys_time<milliseconds> utc { milliseconds(instant(rng)) };
+        minutes offset { offset_minutes(rng) };
+
+        return std::format("{:%FT%T}{}{:02}:{:02}", utc + offset, offset < minutes::zero() ? '-' : '+',
+            std::chrono::abs(offset).count() / 60, std::chrono::abs(offset).count() % 60);
+    }
+
+    /* Times the parser over every input, the checksum keeps the work from being optimized away */
+    template <typename F>
+    static void bench(std::string_view name, const std::vector<std::string>& inputs, size_t rounds, F&& fn) {
+        int64_t checksum = 0;
+
+        auto begin = steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i) {
+            for (const std::string& input : inputs) {
+                checksum += fn(input);
+            }
+        }
+
+        auto elapsed = steady_clock::now() - begin;
+        double calls = static_cast<double>(rounds * inputs.size());
+
+        std::println("{:<24} {:>8.1f} ns/call {:>12.0f} calls/s (checksum {})",
+            name, to_seconds(elapsed) * 1e9 / calls, calls / to_seconds(elapsed), checksum);
+    }
+
+    /* Fixed parser against chrono::parse, wherever the fixed one accepts the input they have to agree */
+    [[nodiscard]] static size_t fuzz(std::mt19937_64& rng, size_t iterations) {
+        static constexpr std::string_view alphabet = "0123456789-+:.TZ /\x7f";
+
+        std::uniform_int_distribution<size_t> mutations { 0, 3 };
+        std::uniform_int_distribution<size_t> letter { 0, alphabet.size() - 1 };
+        std::uniform_int_distribution<int> byte { 0, 255 };
+
+        size_t failures = 0;
+        size_t accepted = 0;
+
+        auto report = [&](std::string_view what, std::string_view input, std::string_view note) {
+            if (failures++ < 20) {
+                std::println(std::cerr, "{}: \"{}\" {}", what, input, note);
+            }
+        };
+
+        for (size_t i = 0; i < iterations; ++i) {
+            std::string input = random_timestamp(rng);
+
+            /* Untouched inputs must always take the fast path */
+            size_t count = i % 2 ? mutations(rng) : 0;
+
+            for (size_t j = 0; j < count; ++j) {
+                size_t pos = std::uniform_int_distribution<size_t> { 0, input.size() - 1 }(rng);
+                input[pos] = j % 2 ? static_cast<char>(byte(rng)) : alphabet[letter(rng)];
+            }
+
+            std::optional<timestamp> fixed = parse_timestamp_fixed(input);
+
+            if (!fixed) {
+                if (count == 0) {
+                    report("rejected", input, "");
+                }
+
+                continue;
+            }
+
+            accepted += 1;
+
+            timestamp generic = parse_timestamp_generic(input);
+            if (*fixed != generic) {
+                report("mismatch", input, std::format("{} != {}", *fixed, generic));
+                continue;
+            }
+
+            std::array<char, timestamp_length> buf {};
+            format_timestamp_to(buf.data(), *fixed);
+
+            std::string expected = std::format(timestamp_format, time_point_cast<milliseconds>(*fixed));
+            if (expected != buf.data()) {
+                report("format", input, std::format("{} != {}", buf.data(), expected));
+                continue;
+            }
+
+            if (parse_timestamp_fixed(buf.data()) != fixed) {
+                report("round trip", input, buf.data());
+            }
+        }
+
+        std::println("fuzz: {} inputs, {} accepted by the fixed parser, {} failures", iterations, accepted, failures);
+
+        return failures;
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        TCLAP::CmdLine cmd { "Compare the fixed-format timestamp parser and formatter with chrono, for speed and agreement" };
+
+        TCLAP::ValueArg<size_t> inputs { "", "inputs", "Distinct timestamps per benchmark round", false, 4096, "COUNT" };
+        TCLAP::ValueArg<size_t> rounds { "", "rounds", "Benchmark rounds", false, 100, "COUNT" };
+        TCLAP::ValueArg<size_t> fuzz { "", "fuzz", "Random and mutated inputs to cross-check", false, 1000000, "COUNT" };
+        TCLAP::ValueArg<uint64_t> seed { "", "seed", "Generator seed", false, 1, "SEED" };
+
+        cmd.add(inputs);
+        cmd.add(rounds);
+        cmd.add(fuzz);
+        cmd.add(seed);
+        cmd.parse(argc, argv);
+
+        std::mt19937_64 rng { seed.getValue() };
+
+        std::vector<std::string> samples;
+        for (size_t i = 0; i < inputs.getValue(); ++i) {
+            samples.push_back(detail::random_timestamp(rng));
+        }
+
+        std::vector<timestamp> parsed;
+        for (const std::string& sample : samples) {
+            parsed.push_back(parse_timestamp(sample));
+        }
+
+        auto ticks = [](timestamp ts) { return static_cast<int64_t>(ts.time_since_epoch().count()); };
+
+        detail::bench("parse (chrono::parse)", samples, rounds.getValue(), [&](const std::string& input) {
+            return ticks(parse_timestamp_generic(input));
+        });
+
+        detail::bench("parse (fixed)", samples, rounds.getValue(), [&](const std::string& input) {
+            return ticks(parse_timestamp_fixed(input).value_or(timestamp {}));
+        });
+
+        size_t index = 0;
+        std::array<char, timestamp_length> buf {};
+
+        detail::bench("format (std::format)", samples, rounds.getValue(), [&](const std::string&) {
+            timestamp ts = parsed[index++ % parsed.size()];
+            auto res = std::format_to_n(buf.data(), buf.size(), timestamp_format, std::chrono::time_point_cast<std::chrono::milliseconds>(ts));
+
+            return static_cast<int64_t>(res.out - buf.data()) + buf[18];
+        });
+
+        detail::bench("format (fixed)", samples, rounds.getValue(), [&](const std::string&) {
+            timestamp ts = parsed[index++ % parsed.size()];
+
+            return static_cast<int64_t>(format_timestamp_to(buf.data(), ts) - buf.data()) + buf[18];
+        });
+
+        if (detail::fuzz(rng, fuzz.getValue()) != 0) {
+            return EXIT_FAILURE;
+        }
+
+    } catch (const std::exception& e) {
+        std::println(std::cerr, "Exception: {}", e.what());
+        return EXIT_FAILURE;
+    }
+}
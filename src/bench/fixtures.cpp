@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "fixtures.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <nlohmann/json.hpp>
+
+#include "danbooru_defs.hpp"
+
+using namespace bench;
+using namespace danbooru;
+
+namespace detail {
+    [[nodiscard]] static std::vector<record> load_records(const std::filesystem::path& path) {
+        std::ifstream in { path };
+        if (!in) {
+            throw std::runtime_error { std::format("Failed to open fixture \"{}\"", path.string()) };
+        }
+
+        json items = json::parse(in);
+        if (!items.is_array()) {
+            throw std::invalid_argument { std::format("Fixture \"{}\" is not an array", path.string()) };
+        }
+
+        std::vector<record> res;
+        res.reserve(items.size());
+
+        for (const json& item : items) {
+            res.push_back({ .id = item.at("id").get<int32_t>(), .body = item.dump() });
+        }
+
+        std::ranges::sort(res, {}, &record::id);
+
+        return res;
+    }
+}
+
+fixtures fixtures::generate(size_t posts, size_t tags, uint32_t seed) {
+    if (tags == 0) {
+        throw std::invalid_argument { "Need at least one tag" };
+    }
+
+    fixtures res;
+
+    std::mt19937 rng { seed };
+    timestamp epoch = clock::from_sys(std::chrono::sys_days { std::chrono::year { 2020 } / 1 / 1 });
+
+    std::vector<std::string> names;
+    names.reserve(tags);
+
+    for (size_t i = 1; i <= tags; ++i) {
+        tag src {
+            .id = static_cast<int32_t>(i),
+            .name = std::format("tag_{}", i),
+            .post_count = 0,
+            .category = tag_category::general,
+            .is_deprecated = false,
+            .created_at = epoch,
+            .updated_at = epoch,
+        };
+
+        names.push_back(src.name);
+        res.tags.push_back({ .id = src.id, .body = json(src).dump() });
+    }
+
+    /* Cubing a uniform sample favours low indices, roughly like real tag popularity */
+    std::uniform_real_distribution<double> popularity { 0., 1. };
+    std::uniform_int_distribution<size_t> tag_count { 10, 40 };
+    std::uniform_int_distribution<int> rating { 0, 3 };
+
+    for (size_t i = 1; i <= posts; ++i) {
+        int32_t id = static_cast<int32_t>(i);
+        timestamp created_at = epoch + std::chrono::minutes(id);
+
+        std::unordered_set<size_t> picked;
+        for (size_t count = std::min(tag_count(rng), tags); picked.size() < count;) {
+            double u = popularity(rng);
+            picked.insert(std::min(static_cast<size_t>(u * u * u * tags), tags - 1));
+        }
+
+        std::vector<std::string> post_tags;
+        for (size_t tag : picked) {
+            post_tags.push_back(names[tag]);
+        }
+
+        std::string tag_string;
+        for (const std::string& tag : post_tags) {
+            if (!tag_string.empty()) {
+                tag_string += ' ';
+            }
+
+            tag_string += tag;
+        }
+
+        api_response::post post {
+            .id = id,
+            .uploader_id = 1,
+            .approver_id = std::nullopt,
+            .tag_string = std::move(tag_string),
+            .rating = static_cast<post_rating>(rating(rng)),
+            .parent_id = std::nullopt,
+            .source = std::format("https://example.com/{}", id),
+            .media_asset = {
+                .id = id,
+                .md5 = std::format("{:032x}", id),
+                .file_ext = file_type::jpg,
+                .file_size = 1 << 20,
+                .image_width = 1920,
+                .image_height = 1080,
+                .duration = std::nullopt,
+                .pixel_hash = std::format("{:032x}", id),
+                .status = asset_status::active,
+                .file_key = std::format("{:09x}", id),
+                .is_public = true,
+                .variants = {
+                    { .type = "180x180", .width = 180, .height = 101, .file_ext = file_type::jpg },
+                    { .type = "original", .width = 1920, .height = 1080, .file_ext = file_type::jpg },
+                },
+                .created_at = created_at,
+                .updated_at = created_at,
+            },
+            .fav_count = 0,
+            .has_children = false,
+            .up_score = 0,
+            .down_score = 0,
+            .is_pending = false,
+            .is_flagged = false,
+            .is_deleted = false,
+            .is_banned = false,
+            .pixiv_id = std::nullopt,
+            .bit_flags = 0,
+            .last_commented_at = std::nullopt,
+            .last_comment_bumped_at = std::nullopt,
+            .last_noted_at = std::nullopt,
+            .created_at = created_at,
+            .updated_at = created_at,
+        };
+
+        api_response::post_version version {
+            .id = id,
+            .post_id = id,
+            .added_tags = std::move(post_tags),
+            .removed_tags = {},
+            .updater_id = 1,
+            .updated_at = created_at,
+            .rating = post.rating,
+            .rating_changed = true,
+            .parent_id = std::nullopt,
+            .parent_changed = false,
+            .source = post.source,
+            .source_changed = true,
+            .version = 1,
+        };
+
+        res.posts.push_back({ .id = id, .body = json(post).dump() });
+        res.post_versions.push_back({ .id = id, .body = json(version).dump() });
+    }
+
+    res._index();
+
+    return res;
+}
+
+fixtures fixtures::load(const std::filesystem::path& dir) {
+    fixtures res {
+        .posts = detail::load_records(dir / "posts.json"),
+        .tags = detail::load_records(dir / "tags.json"),
+        .post_versions = detail::load_records(dir / "post_versions.json"),
+    };
+
+    res._index();
+
+    return res;
+}
+
+void fixtures::_index() {
+    tag_by_name.clear();
+    versions_by_post.clear();
+
+    for (size_t i = 0; i < tags.size(); ++i) {
+        tag_by_name.emplace(json::parse(tags[i].body).at("name").get<std::string>(), i);
+    }
+
+    for (size_t i = 0; i < post_versions.size(); ++i) {
+        versions_by_post[json::parse(post_versions[i].body).at("post_id").get<int32_t>()].push_back(i);
+    }
+}
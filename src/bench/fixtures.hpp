@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef FIXTURES_HPP
+#define FIXTURES_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <util.hpp>
+
+namespace bench {
+    /* Serialized API object, kept as text so serving it costs a copy */
+    struct record {
+        int32_t id;
+        std::string body;
+    };
+
+    /* Data served by the mock server, every list sorted by ID */
+    struct fixtures {
+        std::vector<record> posts;
+        std::vector<record> tags;
+        std::vector<record> post_versions;
+
+        /* Lookups for the searches the client makes */
+        util::unordered_string_map<size_t> tag_by_name;
+        std::unordered_map<int32_t, std::vector<size_t>> versions_by_post;
+
+        /* Posts with a skewed tag distribution, one version each */
+        [[nodiscard]] static fixtures generate(size_t posts, size_t tags, uint32_t seed);
+
+        /* Recorded responses: posts.json, tags.json and post_versions.json, each a JSON array */
+        [[nodiscard]] static fixtures load(const std::filesystem::path& dir);
+
+        private:
+        void _index();
+    };
+}
+
+#endif /* FIXTURES_HPP */
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <iostream>
+#include <format>
+#include <stdexcept>
+#include <csignal>
+#include <atomic>
+
+#include <tclap/CmdLine.h>
+
+#include <logging.hpp>
+
+#include "fixtures.hpp"
+#include "mock_server.hpp"
+
+static std::atomic_flag signal_flag = ATOMIC_FLAG_INIT;
+
+static void signal_handler(int signal) {
+    signal_flag.test_and_set();
+    signal_flag.notify_all();
+}
+
+int main(int argc, char** argv) {
+    try {
+        TCLAP::CmdLine cmd { "Serve recorded or generated fixtures in place of the Danbooru API" };
+
+        TCLAP::ValueArg<std::string> host { "", "host", "Address to listen on", false, "127.0.0.1", "HOST" };
+        TCLAP::ValueArg<int> port { "p", "port", "Port to listen on, 0 for any", false, 8080, "PORT" };
+        TCLAP::ValueArg<std::string> fixture_dir { "f", "fixtures", "Directory with posts.json, tags.json and post_versions.json", false, "", "DIR" };
+        TCLAP::ValueArg<size_t> posts { "", "posts", "Posts to generate", false, 20000, "COUNT" };
+        TCLAP::ValueArg<size_t> tags { "", "tags", "Tags to generate", false, 5000, "COUNT" };
+        TCLAP::ValueArg<uint32_t> seed { "", "seed", "Generator seed", false, 1, "SEED" };
+        TCLAP::ValueArg<int64_t> latency { "", "latency", "Added latency per request", false, 0, "MS" };
+        TCLAP::ValueArg<int64_t> jitter { "", "jitter", "Random extra latency, up to", false, 0, "MS" };
+        TCLAP::ValueArg<double> error_rate { "", "error-rate", "Fraction of requests that fail", false, 0, "RATE" };
+        TCLAP::ValueArg<int> error_status { "", "error-status", "Status code of failed requests", false, 503, "STATUS" };
+
+        cmd.add(host);
+        cmd.add(port);
+        cmd.add(fixture_dir);
+        cmd.add(posts);
+        cmd.add(tags);
+        cmd.add(seed);
+        cmd.add(latency);
+        cmd.add(jitter);
+        cmd.add(error_rate);
+        cmd.add(error_status);
+        cmd.parse(argc, argv);
+
+        util::logging::setup();
+
+        bench::fixtures data = fixture_dir.isSet()
+            ? bench::fixtures::load(fixture_dir.getValue())
+            : bench::fixtures::generate(posts.getValue(), tags.getValue(), seed.getValue());
+
+        spdlog::info("Serving {} posts, {} tags, {} post versions", data.posts.size(), data.tags.size(), data.post_versions.size());
+
+        bench::mock_server server { std::move(data), {
+            .latency = std::chrono::milliseconds(latency.getValue()),
+            .jitter = std::chrono::milliseconds(jitter.getValue()),
+            .error_rate = error_rate.getValue(),
+            .error_status = error_status.getValue(),
+        } };
+
+        server.start(host.getValue(), port.getValue());
+
+        std::signal(SIGINT, signal_handler);
+        std::signal(SIGTERM, signal_handler);
+
+        signal_flag.wait(false);
+
+        server.stop();
+
+        spdlog::info("Served {} requests, {} injected errors", server.requests(), server.errors());
+
+    } catch (const std::exception& e) {
+        std::println(std::cerr, "Exception: {}", e.what());
+        return EXIT_FAILURE;
+    }
+}
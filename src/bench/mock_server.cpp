@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "mock_server.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <random>
+#include <ranges>
+#include <stdexcept>
+
+#include <logging.hpp>
+
+using namespace bench;
+using json = nlohmann::json;
+
+namespace detail {
+    /* Inclusive ID bounds */
+    struct id_range {
+        int32_t lo = std::numeric_limits<int32_t>::min();
+        int32_t hi = std::numeric_limits<int32_t>::max();
+    };
+
+    [[nodiscard]] static int32_t parse_id(std::string_view str) {
+        int32_t res = 0;
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), res);
+        if (ec != std::errc {} || ptr != str.data() + str.size()) {
+            throw std::invalid_argument { std::format("Invalid ID \"{}\"", str) };
+        }
+
+        return res;
+    }
+
+    /* "a..b", "..b", "a..", "<b", ">a" or a single ID */
+    [[nodiscard]] static id_range parse_range(std::string_view str) {
+        id_range res;
+
+        if (str.starts_with('<')) {
+            res.hi = parse_id(str.substr(1)) - 1;
+        } else if (str.starts_with('>')) {
+            res.lo = parse_id(str.substr(1)) + 1;
+        } else if (size_t dots = str.find(".."); dots != std::string_view::npos) {
+            if (dots > 0) {
+                res.lo = parse_id(str.substr(0, dots));
+            }
+
+            if (dots + 2 < str.size()) {
+                res.hi = parse_id(str.substr(dots + 2));
+            }
+        } else {
+            res.lo = res.hi = parse_id(str);
+        }
+
+        return res;
+    }
+
+    /* JSON array, or a comma-separated string */
+    [[nodiscard]] static std::vector<std::string> parse_list(const json& val) {
+        if (val.is_array()) {
+            return val.get<std::vector<std::string>>();
+        }
+
+        std::string str = val.is_string() ? val.get<std::string>() : val.dump();
+
+        return str
+            | std::views::split(',')
+            | std::views::transform([](const auto& part) { return std::string { part.begin(), part.end() }; })
+            | std::ranges::to<std::vector>();
+    }
+
+    /* Numbers may arrive as strings */
+    [[nodiscard]] static int64_t parse_int(const json& val) {
+        if (val.is_number_integer()) {
+            return val.get<int64_t>();
+        }
+
+        std::string str = val.get<std::string>();
+        return parse_id(str);
+    }
+
+    [[nodiscard]] static std::string join(auto&& bodies) {
+        std::string res = "[";
+        for (const std::string& body : bodies) {
+            if (res.size() > 1) {
+                res += ',';
+            }
+
+            res += body;
+        }
+
+        res += ']';
+        return res;
+    }
+
+    /* Newest first like the site, "page" is a page number, a<id> or b<id> */
+    [[nodiscard]] static std::string paginate(const std::vector<record>& items, id_range range, const json& params) {
+        size_t limit = params.contains("limit") ? static_cast<size_t>(parse_int(params["limit"])) : 20;
+
+        auto first = std::ranges::lower_bound(items, range.lo, {}, &record::id);
+        auto last = std::ranges::upper_bound(items, range.hi, {}, &record::id);
+        if (first > last) {
+            first = last;
+        }
+
+        std::string page = params.contains("page") ? (params["page"].is_string() ? params["page"].get<std::string>() : params["page"].dump()) : "1";
+
+        if (page.starts_with('a')) {
+            first = std::ranges::upper_bound(first, last, parse_id(page.substr(1)), {}, &record::id);
+            last = first + std::min<size_t>(limit, last - first);
+        } else if (page.starts_with('b')) {
+            last = std::ranges::lower_bound(first, last, parse_id(page.substr(1)), {}, &record::id);
+            first = last - std::min<size_t>(limit, last - first);
+        } else {
+            size_t skip = (std::max<int64_t>(parse_id(page), 1) - 1) * limit;
+            last -= std::min<size_t>(skip, last - first);
+            first = last - std::min<size_t>(limit, last - first);
+        }
+
+        return join(std::ranges::subrange(first, last) | std::views::reverse | std::views::transform(&record::body));
+    }
+
+    /* search[x]=y arrives flattened when sent as a GET */
+    static void set_param(json& params, const std::string& key, const std::string& val) {
+        if (size_t open = key.find('['); open != std::string::npos && key.ends_with(']')) {
+            params[key.substr(0, open)][key.substr(open + 1, key.size() - open - 2)] = val;
+        } else {
+            params[key] = val;
+        }
+    }
+}
+
+mock_server::mock_server(fixtures data, options opts) : _data { std::move(data) }, _opts { opts } {
+    _server.new_task_queue = [threads = _opts.threads] { return new httplib::ThreadPool(threads); };
+
+    /* The client keeps connections alive indefinitely, so should we */
+    _server.set_keep_alive_max_count(std::numeric_limits<int>::max());
+
+    auto handler = [this](const httplib::Request& req, httplib::Response& res) { _handle(req, res); };
+
+    _server.Get(R"(/(\w+)\.json)", handler);
+    _server.Post(R"(/(\w+)\.json)", handler);
+}
+
+mock_server::~mock_server() {
+    stop();
+}
+
+int mock_server::start(const std::string& host, int port) {
+    if (port == 0) {
+        port = _server.bind_to_any_port(host);
+    } else if (!_server.bind_to_port(host, port)) {
+        port = -1;
+    }
+
+    if (port < 0) {
+        throw std::runtime_error { std::format("Failed to bind to {}:{}", host, port) };
+    }
+
+    _thread = std::jthread { [this] { _server.listen_after_bind(); } };
+    _server.wait_until_ready();
+
+    spdlog::info("Mock server listening on {}:{}", host, port);
+
+    return port;
+}
+
+void mock_server::stop() {
+    _server.stop();
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+const fixtures& mock_server::data() const {
+    return _data;
+}
+
+uint64_t mock_server::requests() const {
+    return _requests.load(std::memory_order::relaxed);
+}
+
+uint64_t mock_server::errors() const {
+    return _errors.load(std::memory_order::relaxed);
+}
+
+void mock_server::_handle(const httplib::Request& req, httplib::Response& res) {
+    thread_local std::mt19937 rng { std::random_device {}() };
+
+    _requests.fetch_add(1, std::memory_order::relaxed);
+
+    auto delay = _opts.latency;
+    if (_opts.jitter.count() > 0) {
+        delay += std::chrono::milliseconds(std::uniform_int_distribution<int64_t> { 0, _opts.jitter.count() }(rng));
+    }
+
+    if (delay.count() > 0) {
+        std::this_thread::sleep_for(delay);
+    }
+
+    if (_opts.error_rate > 0 && std::bernoulli_distribution { _opts.error_rate }(rng)) {
+        _errors.fetch_add(1, std::memory_order::relaxed);
+
+        res.status = _opts.error_status;
+        if (_opts.error_status == 429 || _opts.error_status == 503) {
+            res.set_header("Retry-After", std::to_string(_opts.retry_after.count()));
+        }
+
+        res.set_content(R"({"success":false,"message":"injected error"})", "application/json");
+        return;
+    }
+
+    try {
+        json params = json::object();
+
+        /* Bodies come from get_as_post requests, the override header is implied */
+        if (!req.body.empty()) {
+            params = json::parse(req.body);
+        }
+
+        for (const auto& [key, val] : req.params) {
+            detail::set_param(params, key, val);
+        }
+
+        res.set_content(_respond(req.matches[1].str(), params), "application/json");
+    } catch (const std::exception& e) {
+        spdlog::warn("{} {}: {}", req.method, req.path, e.what());
+
+        res.status = 422;
+        res.set_content(json { { "success", false }, { "message", e.what() } }.dump(), "application/json");
+    }
+}
+
+std::string mock_server::_respond(std::string_view endpoint, const json& params) const {
+    const json search = params.value("search", json::object());
+
+    if (endpoint == "profile") {
+        return json { { "id", 1 }, { "name", "mock" }, { "level", 20 } }.dump();
+    }
+
+    if (endpoint == "posts") {
+        detail::id_range range;
+
+        for (const auto& token : params.value("tags", std::string {}) | std::views::split(' ')) {
+            std::string_view tag { token.begin(), token.end() };
+            if (tag.empty()) {
+                continue;
+            }
+
+            if (!tag.starts_with("id:")) {
+                throw std::invalid_argument { std::format("Unsupported tag search \"{}\"", tag) };
+            }
+
+            detail::id_range bound = detail::parse_range(tag.substr(3));
+            range.lo = std::max(range.lo, bound.lo);
+            range.hi = std::min(range.hi, bound.hi);
+        }
+
+        return detail::paginate(_data.posts, range, params);
+    }
+
+    if (endpoint == "tags") {
+        if (!search.contains("name")) {
+            return detail::paginate(_data.tags, {}, params);
+        }
+
+        std::vector<size_t> found;
+        for (const std::string& name : detail::parse_list(search["name"])) {
+            if (auto it = _data.tag_by_name.find(name); it != _data.tag_by_name.end()) {
+                found.push_back(it->second);
+            }
+        }
+
+        std::ranges::sort(found, std::greater {});
+
+        return detail::join(found | std::views::transform([this](size_t i) -> const std::string& { return _data.tags[i].body; }));
+    }
+
+    if (endpoint == "post_versions") {
+        if (search.contains("post_id")) {
+            std::vector<size_t> found;
+            for (const std::string& id : detail::parse_list(search["post_id"])) {
+                if (auto it = _data.versions_by_post.find(detail::parse_id(id)); it != _data.versions_by_post.end()) {
+                    found.insert(found.end(), it->second.begin(), it->second.end());
+                }
+            }
+
+            std::ranges::sort(found);
+            found.erase(std::ranges::unique(found).begin(), found.end());
+
+            std::vector<record> matching;
+            for (size_t i : found) {
+                matching.push_back(_data.post_versions[i]);
+            }
+
+            return detail::paginate(matching, {}, params);
+        }
+
+        detail::id_range range;
+        if (search.contains("id")) {
+            range = detail::parse_range(search["id"].is_string() ? search["id"].get<std::string>() : search["id"].dump());
+        }
+
+        return detail::paginate(_data.post_versions, range, params);
+    }
+
+    throw std::invalid_argument { std::format("Unknown endpoint \"{}\"", endpoint) };
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef MOCK_SERVER_HPP
+#define MOCK_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+
+#include "fixtures.hpp"
+
+namespace bench {
+    /* Stand-in for the parts of the Danbooru API the client uses: profile, posts, tags and post_versions */
+    class mock_server {
+        public:
+        struct options {
+            /* Added to every response, plus up to jitter at random */
+            std::chrono::milliseconds latency { 0 };
+            std::chrono::milliseconds jitter { 0 };
+
+            /* Fraction of requests answered with error_status instead */
+            double error_rate = 0;
+            int error_status = 503;
+
+            /* Sent with 429 and 503 errors */
+            std::chrono::seconds retry_after { 0 };
+
+            size_t threads = 64;
+        };
+
+        private:
+        fixtures _data;
+        options _opts;
+
+        httplib::Server _server;
+        std::jthread _thread;
+
+        std::atomic<uint64_t> _requests = 0;
+        std::atomic<uint64_t> _errors = 0;
+
+        public:
+        mock_server(fixtures data, options opts);
+        ~mock_server();
+
+        mock_server(const mock_server&) = delete;
+        mock_server& operator=(const mock_server&) = delete;
+
+        /* Serve on a background thread, port 0 picks a free one, returns the bound port */
+        int start(const std::string& host, int port);
+        void stop();
+
+        [[nodiscard]] const fixtures& data() const;
+
+        [[nodiscard]] uint64_t requests() const;
+
+        /* Injected errors only */
+        [[nodiscard]] uint64_t errors() const;
+
+        private:
+        void _handle(const httplib::Request& req, httplib::Response& res);
+
+        /* JSON array response for an endpoint */
+        [[nodiscard]] std::string _respond(std::string_view endpoint, const nlohmann::json& params) const;
+    };
+}
+
+#endif /* MOCK_SERVER_HPP */
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "binary_params.hpp"
+
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+
+using namespace database;
+
+namespace detail {
+    /* Type OIDs from pg_type.h, array_recv checks the element type */
+    static constexpr uint32_t int4_oid = 23;
+    static constexpr uint32_t int8_oid = 20;
+    static constexpr uint32_t text_oid = 25;
+
+    /* 2000-01-01T00:00:00Z */
+    static constexpr std::chrono::sys_seconds postgres_epoch { std::chrono::seconds(946'684'800) };
+
+    /* Network byte order */
+    template <typename T>
+    static void put(binary::bytes& dst, T val) {
+        auto raw = static_cast<std::make_unsigned_t<T>>(val);
+        for (size_t shift = sizeof(T) * 8; shift > 0; shift -= 8) {
+            dst.push_back(static_cast<std::byte>(raw >> (shift - 8)));
+        }
+    }
+
+    static void put(binary::bytes& dst, std::string_view str) {
+        for (char c : str) {
+            dst.push_back(static_cast<std::byte>(c));
+        }
+    }
+
+    /* ndim, has-null flag, element type, then length and lower bound of the only dimension */
+    static void put_array_header(binary::bytes& dst, uint32_t element_oid, size_t size) {
+        if (size > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+            throw std::length_error { std::format("Array of {} elements is too large", size) };
+        }
+
+        put<int32_t>(dst, size ? 1 : 0);
+        put<int32_t>(dst, 0);
+        put<uint32_t>(dst, element_oid);
+
+        if (size) {
+            put<int32_t>(dst, static_cast<int32_t>(size));
+            put<int32_t>(dst, 1);
+        }
+    }
+}
+
+binary::bytes binary::int4(int32_t val) {
+    bytes res;
+    detail::put(res, val);
+    return res;
+}
+
+binary::bytes binary::boolean(bool val) {
+    return bytes(1, static_cast<std::byte>(val ? 1 : 0));
+}
+
+binary::bytes binary::text(std::string_view val) {
+    bytes res;
+    detail::put(res, val);
+    return res;
+}
+
+binary::bytes binary::timestamp(danbooru::timestamp val) {
+    auto sys = std::chrono::clock_cast<std::chrono::system_clock>(val);
+    auto micros = std::chrono::floor<std::chrono::microseconds>(sys - detail::postgres_epoch);
+
+    bytes res;
+    detail::put<int64_t>(res, micros.count());
+    return res;
+}
+
+binary::bytes binary::int4_array(std::span<const int32_t> vals) {
+    bytes res;
+    res.reserve(20 + vals.size() * 8);
+
+    detail::put_array_header(res, detail::int4_oid, vals.size());
+    for (int32_t val : vals) {
+        detail::put<int32_t>(res, sizeof(int32_t));
+        detail::put(res, val);
+    }
+
+    return res;
+}
+
+binary::bytes binary::int8_array(std::span<const int64_t> vals) {
+    bytes res;
+    res.reserve(20 + vals.size() * 12);
+
+    detail::put_array_header(res, detail::int8_oid, vals.size());
+    for (int64_t val : vals) {
+        detail::put<int32_t>(res, sizeof(int64_t));
+        detail::put(res, val);
+    }
+
+    return res;
+}
+
+binary::bytes binary::text_array(std::span<const std::string_view> vals) {
+    size_t size = 20;
+    for (std::string_view val : vals) {
+        size += 4 + val.size();
+    }
+
+    bytes res;
+    res.reserve(size);
+
+    detail::put_array_header(res, detail::text_oid, vals.size());
+    for (std::string_view val : vals) {
+        detail::put<int32_t>(res, static_cast<int32_t>(val.size()));
+        detail::put(res, val);
+    }
+
+    return res;
+}
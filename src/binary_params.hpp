@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef BINARY_PARAMS_HPP
+#define BINARY_PARAMS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <magic_enum.hpp>
+
+/* Too new of a feature, vcpkg doesn't build libpqxx with it */
+#undef __cpp_lib_source_location
+#include <pqxx/pqxx>
+
+#include "danbooru_defs.hpp"
+
+namespace database::binary {
+    using bytes = std::basic_string<std::byte>;
+
+    /* Values in Postgres' binary send/recv format */
+    [[nodiscard]] bytes int4(int32_t val);
+    [[nodiscard]] bytes boolean(bool val);
+    [[nodiscard]] bytes text(std::string_view val);
+
+    /* Microseconds since 2000-01-01, for TIMESTAMP (without time zone) columns holding UTC */
+    [[nodiscard]] bytes timestamp(danbooru::timestamp val);
+
+    /* One-dimensional arrays without nulls */
+    [[nodiscard]] bytes int4_array(std::span<const int32_t> vals);
+    [[nodiscard]] bytes int8_array(std::span<const int64_t> vals);
+    [[nodiscard]] bytes text_array(std::span<const std::string_view> vals);
+
+    /* Statement parameters sent in binary, each has to match the parameter's type exactly */
+    class params {
+        pqxx::params _params;
+
+        public:
+        params() = default;
+
+        template <typename... Args>
+        explicit params(const Args&... args) {
+            (add(args), ...);
+        }
+
+        params& add(int32_t val) { return _append(int4(val)); }
+        params& add(bool val) { return _append(boolean(val)); }
+        params& add(std::string_view val) { return _append(text(val)); }
+        params& add(const std::string& val) { return _append(text(val)); }
+        params& add(danbooru::timestamp val) { return _append(timestamp(val)); }
+        params& add(const std::vector<int32_t>& vals) { return _append(int4_array(vals)); }
+        params& add(const std::vector<int64_t>& vals) { return _append(int8_array(vals)); }
+        params& add(const std::vector<std::string_view>& vals) { return _append(text_array(vals)); }
+
+        /* Enums are received by label */
+        template <typename T> requires std::is_enum_v<T>
+        params& add(T val) {
+            return _append(text(magic_enum::enum_name(val)));
+        }
+
+        template <typename T>
+        params& add(const std::optional<T>& val) {
+            if (val) {
+                return add(*val);
+            }
+
+            _params.append();
+            return *this;
+        }
+
+        [[nodiscard]] const pqxx::params& get() const {
+            return _params;
+        }
+
+        private:
+        params& _append(bytes&& val) {
+            _params.append(std::move(val));
+            return *this;
+        }
+    };
+}
+
+#endif /* BINARY_PARAMS_HPP */
@@ -5,6 +5,7 @@
 #include <memory>
 #include <csignal>
 #include <atomic>
+#include <vector>
 
 #include <tclap/CmdLine.h>
 #include <pqxx/pqxx>
@@ -14,8 +15,12 @@
 
 #include "danbooru.hpp"
 #include "database.hpp"
+#include "database_pool.hpp"
 
 #include "tasks/fetch_posts.hpp"
+#include "tasks/backfill_posts.hpp"
+#include "tasks/update_posts.hpp"
+#include "tasks/fetch_post_versions.hpp"
 
 static std::atomic_flag signal_flag = ATOMIC_FLAG_INIT;
 
@@ -33,6 +38,9 @@ int main(int argc, char** argv) {
         TCLAP::MultiSwitchArg verbose { "v", "verbose", "Verbose output" };
         cmd.add(verbose);
 
+        TCLAP::SwitchArg backfill { "", "backfill", "Crawl all existing posts in parallel instead of following new ones" };
+        cmd.add(backfill);
+
         cmd.parse(argc, argv);
         util::environment::parse();
 
@@ -59,12 +67,35 @@ int main(int argc, char** argv) {
 
         danbooru::api booru;
 
-        std::array<std::unique_ptr<perpetual_task>, 1> tasks {
-            std::make_unique<tasks::fetch_posts>(
+        database::pool pool { util::environment::get_or_default<size_t>("DATABASE_POOL_SIZE", 8) };
+
+        /* Shared by every task, loaded once */
+        database::tag_dictionary dictionary;
+        dictionary.warm(*pool.acquire());
+
+        std::vector<std::unique_ptr<perpetual_task>> tasks;
+
+        if (backfill.getValue()) {
+            tasks.emplace_back(std::make_unique<tasks::backfill_posts>(
+                "backfill_posts", std::chrono::minutes(5), perpetual_task::timing_mode::after_run,
+                booru, dictionary, pool
+            ));
+        } else {
+            tasks.emplace_back(std::make_unique<tasks::fetch_posts>(
                 "fetch_posts", std::chrono::minutes(5), perpetual_task::timing_mode::per_invocation,
-                booru, database::connection {}
-            ),
-        };
+                booru, dictionary, pool
+            ));
+
+            tasks.emplace_back(std::make_unique<tasks::update_posts>(
+                "update_posts", std::chrono::minutes(5), perpetual_task::timing_mode::per_invocation,
+                booru, dictionary, pool
+            ));
+
+            tasks.emplace_back(std::make_unique<tasks::fetch_post_versions>(
+                "fetch_post_versions", std::chrono::minutes(5), perpetual_task::timing_mode::per_invocation,
+                booru, dictionary, pool
+            ));
+        }
 
         std::signal(SIGINT, signal_handler);
         std::signal(SIGTERM, signal_handler);
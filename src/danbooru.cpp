@@ -2,10 +2,14 @@
 #include "danbooru.hpp"
 
 #include <sstream>
+#include <array>
+#include <bit>
 #include <chrono>
+#include <cstring>
 #include <ranges>
 #include <algorithm>
 #include <future>
+#include <charconv>
 
 #include <magic_enum.hpp>
 
@@ -13,7 +17,108 @@
 
 using namespace danbooru;
 
+namespace detail {
+    /* What parse_timestamp_fixed accepts, '0' stands for a digit and '+' for either sign.
+     * Read literally it's also what format_timestamp_to writes around the digits */
+    static constexpr std::string_view timestamp_shape = "0000-00-00T00:00:00.000+00:00";
+
+    static constexpr size_t timestamp_words = (timestamp_shape.size() + 7) / 8;
+
+    /* Per 8-byte word of the shape: the bytes to compare exactly, what they should be, and where digits go */
+    struct shape_word {
+        uint64_t exact;
+        uint64_t literal;
+        uint64_t digits;
+    };
+
+    static constexpr std::array<shape_word, timestamp_words> shape_words = [] {
+        std::array<shape_word, timestamp_words> res {};
+
+        for (size_t i = 0; i < timestamp_words; ++i) {
+            std::array<unsigned char, 8> exact {}, literal {}, digits {};
+
+            for (size_t j = 0; j < 8; ++j) {
+                size_t pos = i * 8 + j;
+
+                /* Past the end both sides are zero padding */
+                char c = pos < timestamp_shape.size() ? timestamp_shape[pos] : '\0';
+
+                exact[j] = c == '0' || c == '+' ? 0x00 : 0xFF;
+                literal[j] = c == '0' || c == '+' ? 0x00 : static_cast<unsigned char>(c);
+                digits[j] = c == '0' ? 0xFF : 0x00;
+            }
+
+            res[i] = {
+                std::bit_cast<uint64_t>(exact),
+                std::bit_cast<uint64_t>(literal),
+                std::bit_cast<uint64_t>(digits),
+            };
+        }
+
+        return res;
+    }();
+
+    /* SWAR check of one word: separators in place, and every digit position in '0'-'9' */
+    [[nodiscard]] static bool matches_shape(uint64_t word, size_t index) {
+        const shape_word& shape = shape_words[index];
+
+        if (((word ^ shape.literal) & shape.exact) != 0) {
+            return false;
+        }
+
+        /* Non-digit bytes become '0' so they pass, digits need a high nibble of 3 before and after adding 6 */
+        constexpr uint64_t zeros = 0x3030'3030'3030'3030;
+        constexpr uint64_t sixes = 0x0606'0606'0606'0606;
+        constexpr uint64_t high = 0xF0F0'F0F0'F0F0'F0F0;
+
+        uint64_t value = (word & shape.digits) | (zeros & ~shape.digits);
+
+        return ((value & high) | (((value + sixes) & high) >> 4)) == 0x3333'3333'3333'3333;
+    }
+
+    [[nodiscard]] static uint32_t two_digits(const char* src) {
+        return static_cast<uint32_t>(src[0] - '0') * 10 + static_cast<uint32_t>(src[1] - '0');
+    }
+
+    static void put_two_digits(char* dst, uint32_t value) {
+        dst[0] = static_cast<char>('0' + value / 10);
+        dst[1] = static_cast<char>('0' + value % 10);
+    }
+
+    /* Comma-separated weights in request_priority order, e.g. "8,4,1" */
+    [[nodiscard]] static http_executor::weights parse_priority_weights(std::string_view str) {
+        http_executor::weights res;
+
+        size_t count = 0;
+        for (const auto& part : str | std::views::split(',')) {
+            std::string_view weight { part.begin(), part.end() };
+
+            double value = 0;
+            auto [ptr, ec] = std::from_chars(weight.data(), weight.data() + weight.size(), value);
+            if (ec != std::errc {} || value <= 0 || count >= res.size()) {
+                throw std::invalid_argument { std::format("Invalid priority weights: \"{}\"", str) };
+            }
+
+            res[count++] = value;
+        }
+
+        if (count != res.size()) {
+            throw std::invalid_argument { std::format("Expected {} priority weights, got \"{}\"", res.size(), str) };
+        }
+
+        return res;
+    }
+}
+
 timestamp danbooru::parse_timestamp(std::string_view ts) {
+    if (std::optional res = parse_timestamp_fixed(ts)) {
+        return *res;
+    }
+
+    return parse_timestamp_generic(ts);
+}
+
+timestamp danbooru::parse_timestamp_generic(std::string_view ts) {
     std::string date { ts };
 
     std::stringstream ss { date };
@@ -23,8 +128,95 @@ timestamp danbooru::parse_timestamp(std::string_view ts) {
     return res;
 }
 
+std::optional<timestamp> danbooru::parse_timestamp_fixed(std::string_view ts) {
+    using namespace std::chrono;
+
+    if (ts.size() != detail::timestamp_shape.size()) {
+        return std::nullopt;
+    }
+
+    /* Checked eight bytes at a time, the padding matches the pattern's */
+    std::array<char, detail::timestamp_words * 8> buf {};
+    std::ranges::copy(ts, buf.begin());
+
+    for (size_t i = 0; i < detail::timestamp_words; ++i) {
+        uint64_t word;
+        std::memcpy(&word, buf.data() + i * 8, sizeof(word));
+
+        if (!detail::matches_shape(word, i)) {
+            return std::nullopt;
+        }
+    }
+
+    char sign = ts[23];
+    if (sign != '+' && sign != '-') {
+        return std::nullopt;
+    }
+
+    const char* src = ts.data();
+
+    year_month_day date {
+        year { static_cast<int>(detail::two_digits(src) * 100 + detail::two_digits(src + 2)) },
+        month { detail::two_digits(src + 5) },
+        day { detail::two_digits(src + 8) }
+    };
+
+    uint32_t hour = detail::two_digits(src + 11);
+    uint32_t minute = detail::two_digits(src + 14);
+    uint32_t second = detail::two_digits(src + 17);
+    uint32_t milli = detail::two_digits(src + 20) * 10 + static_cast<uint32_t>(src[22] - '0');
+    uint32_t offset_hour = detail::two_digits(src + 24);
+    uint32_t offset_minute = detail::two_digits(src + 27);
+
+    /* Out of range fields, and leap seconds, are left to chrono::parse */
+    if (!date.ok() || hour > 23 || minute > 59 || second > 59 || offset_hour > 23 || offset_minute > 59) {
+        return std::nullopt;
+    }
+
+    sys_time<milliseconds> local = sys_days { date } + hours(hour) + minutes(minute) + seconds(second) + milliseconds(milli);
+    minutes offset = hours(offset_hour) + minutes(offset_minute);
+
+    return clock::from_sys(sign == '+' ? local - offset : local + offset);
+}
+
 std::string danbooru::format_timestamp(timestamp time) {
-    return std::format(timestamp_format, std::chrono::time_point_cast<std::chrono::milliseconds>(time));
+    std::string res(timestamp_length - 1, '\0');
+    format_timestamp_to(res.data(), time);
+
+    return res;
+}
+
+char* danbooru::format_timestamp_to(char* dst, timestamp time) {
+    using namespace std::chrono;
+
+    auto sys = floor<milliseconds>(clock::to_sys(time));
+    auto date_part = floor<days>(sys);
+
+    year_month_day date { date_part };
+    hh_mm_ss time_of_day { sys - date_part };
+
+    int year_value = static_cast<int>(date.year());
+
+    /* Outside of four digit years, and during leap seconds, the layout isn't fixed */
+    if (year_value < 0 || year_value > 9999 || get_leap_second_info(time).is_leap_second) {
+        return std::format_to_n(dst, timestamp_length - 1, timestamp_format, time_point_cast<milliseconds>(time)).out;
+    }
+
+    std::memcpy(dst, detail::timestamp_shape.data(), detail::timestamp_shape.size());
+
+    detail::put_two_digits(dst, static_cast<uint32_t>(year_value / 100));
+    detail::put_two_digits(dst + 2, static_cast<uint32_t>(year_value % 100));
+    detail::put_two_digits(dst + 5, static_cast<unsigned>(date.month()));
+    detail::put_two_digits(dst + 8, static_cast<unsigned>(date.day()));
+    detail::put_two_digits(dst + 11, static_cast<uint32_t>(time_of_day.hours().count()));
+    detail::put_two_digits(dst + 14, static_cast<uint32_t>(time_of_day.minutes().count()));
+    detail::put_two_digits(dst + 17, static_cast<uint32_t>(time_of_day.seconds().count()));
+
+    auto millis = static_cast<uint32_t>(time_of_day.subseconds().count());
+    detail::put_two_digits(dst + 20, millis / 10);
+    dst[22] = static_cast<char>('0' + millis % 10);
+
+    return dst + detail::timestamp_shape.size();
 }
 
 std::string page_selector::str() const {
@@ -61,18 +253,31 @@ page_selector page_selector::after(uint32_t value) {
 }
 
 api::api()
-    : _rl {
+    : _base_url { util::environment::get_or_default("DANBOORU_URL", std::string_view { "https://danbooru.donmai.us" }) }
+    , _rl {
         util::environment::get_or_default<uint64_t>("DANBOORU_RATE_LIMIT", 5),
         std::chrono::seconds(1)
     }
-    , _auth {
-        util::environment::get<std::string>("DANBOORU_LOGIN"),
-        util::environment::get<std::string>("DANBOORU_API_KEY"),
-        cpr::AuthMode::BASIC
+    , _sessions {
+        cpr::Authentication {
+            util::environment::get<std::string>("DANBOORU_LOGIN"),
+            util::environment::get<std::string>("DANBOORU_API_KEY"),
+            cpr::AuthMode::BASIC
+        },
+        std::format("hoshino.bot user {}", util::environment::get<std::string>("DANBOORU_LOGIN")),
+        util::environment::get_or_default<bool>("DANBOORU_HTTP2", false),
+        util::environment::get_or_default<bool>("DANBOORU_COMPRESSION", true)
     }
-    , _user_agent { std::format("hoshino.bot user {}", util::environment::get<std::string>("DANBOORU_LOGIN")) } {
+    , _executor {
+        _rl,
+        detail::parse_priority_weights(util::environment::get_or_default("DANBOORU_PRIORITY_WEIGHTS", std::string_view { "8,4,1" }))
+    } {
 
-    spdlog::info("Rate limit: {} / s", _rl.bucket_size());
+    while (_base_url.ends_with('/')) {
+        _base_url.pop_back();
+    }
+
+    spdlog::info("API: {}, rate limit: {} / s", _base_url, _rl.bucket_size());
 
     /* Verify login */
     auto res = fetch("profile", json::object({ { "only", "id,name,level" } })).get();
@@ -86,76 +291,130 @@ api::api()
     _level = *magic_enum::enum_cast<user_level>(res["level"].get<int32_t>());
 
     /* Be nice to evazion, tell him who we are */
-    _user_agent = std::format("{} (#{})", _user_agent, _user_id);
+    _sessions.set_user_agent(std::format("hoshino.bot user {} (#{})", util::environment::get<std::string>("DANBOORU_LOGIN"), _user_id));
 
     spdlog::info("Logging in as {} (user #{}), level: {}", _user_id, _user_id, magic_enum::enum_name(_level));
 }
 
+void api::log_stats() {
+    uint64_t requests = 0;
+    uint64_t connects = 0;
+
+    auto stats = _sessions.stats();
+    for (const session_pool::session_stats& ses : stats) {
+        spdlog::debug("Session #{}: {} requests, {} new connections", ses.id, ses.requests, ses.connects);
+
+        requests += ses.requests;
+        connects += ses.connects;
+    }
+
+    spdlog::info("{} sessions, {} requests, {} new connections", stats.size(), requests, connects);
+
+    auto waits = _executor.waits();
+    for (size_t i = 0; i < waits.size(); ++i) {
+        const http_executor::wait_stats& wait = waits[i];
+        if (wait.requests == 0) {
+            continue;
+        }
+
+        spdlog::info("{}: {} requests, waited {} on average, {} at most",
+            magic_enum::enum_name(magic_enum::enum_value<request_priority>(i)),
+            wait.requests,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(wait.total / wait.requests),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(wait.max)
+        );
+    }
+
+    for (const auto& [endpoint, transfer] : _executor.transfers()) {
+        spdlog::info("/{}: {} requests, {:.2f} MiB on the wire, {:.2f} MiB decoded ({:.1f}x)",
+            endpoint, transfer.requests,
+            transfer.wire_bytes / 1048576.,
+            transfer.body_bytes / 1048576.,
+            transfer.wire_bytes ? static_cast<double>(transfer.body_bytes) / transfer.wire_bytes : 1.
+        );
+    }
+}
+
 std::future<std::vector<tag>> api::tags(page_selector page, size_t limit) {
     if (limit > page_limit) {
         throw std::invalid_argument { std::format("limit of {} is too large (max: {})", limit, page_limit) };
     }
 
-    return fetch<std::vector<tag>>("tags", { page, { "limit", std::to_string(limit) } }, [](const json& j) -> std::vector<tag> {
-        return j;
-    });
+    return fetch<std::vector<tag>>("tags", { page, { "limit", std::to_string(limit) } });
 }
 
 std::future<util::unordered_string_map<int32_t>> danbooru::fetch_and_insert_tags(
-    api& booru, database::connection& db, const util::unordered_string_set& tags, database::insert_mode mode) {
+    api& booru, database::connection& db, database::tag_dictionary& dictionary,
+    const util::unordered_string_set& tags, database::insert_mode mode) {
 
-    return std::async([&booru, &db, &tags, mode]() {
-        util::unordered_string_map<int32_t> tag_ids;
+    /* Runs when the caller waits on it, requests are already asynchronous */
+    return std::async(std::launch::deferred, [&booru, &db, &dictionary, &tags, mode]() {
+        database::tag_lookup cached = dictionary.find(tags);
+
+        util::unordered_string_map<int32_t> tag_ids = std::move(cached.ids);
+        if (cached.missing.empty()) {
+            return tag_ids;
+        }
 
         auto tx = db.work();
 
         /* Fetch which IDs we already know*/
-        std::vector<std::string_view> tags_to_fetch;
-        for (std::string_view tag : tags) {
-            int32_t id = db.tag_id(tx, tag);
-            if (id) {
-                tag_ids.emplace(tag, id);
-            } else {
-                tags_to_fetch.emplace_back(tag);
-            }
+        database::tag_lookup known = db.tag_ids(tx, cached.missing);
+        for (auto& [name, id] : known.ids) {
+            tag_ids.insert_or_assign(name, id);
         }
 
+        const std::vector<std::string_view>& tags_to_fetch = known.missing;
+
         if (!tags_to_fetch.empty()) {
-            std::vector<std::future<json>> futures;
+            std::vector<std::future<std::vector<tag>>> futures;
             futures.reserve((tags_to_fetch.size() + page_limit - 1) / page_limit);
 
             /* Queue requests */
             for (const auto& chunk : tags_to_fetch | std::views::chunk(page_limit)) {
                 futures.emplace_back(
-                    booru.fetch("tags", {
+                    booru.fetch<std::vector<tag>>("tags", {
                         { "limit", page_limit },
                         { "search", { { "name", chunk } } }
                     })
                 );
             }
 
+            std::vector<tag> fetched;
+            for (std::vector<tag> res : futures | std::views::transform(&std::future<std::vector<tag>>::get)) {
+                fetched.insert(fetched.end(), std::make_move_iterator(res.begin()), std::make_move_iterator(res.end()));
+            }
+
+            /* Insert in ID order, concurrent writers then lock rows in the same order and can't deadlock */
+            std::ranges::sort(fetched, {}, &tag::id);
+
             /* Process results and insert tags  */
-            for (std::vector<tag> res : futures | std::views::transform(&std::future<json>::get)) {
-                for (tag& src : res) {
-                    tag_ids[src.name] = src.id;
+            for (tag& src : fetched) {
+                tag_ids[src.name] = src.id;
 
-                    /* Calculate this ourselves */
-                    src.post_count = 0;
-                    db.insert(tx, src, mode);
-                }
+                /* Calculate this ourselves */
+                src.post_count = 0;
+                db.insert(tx, src, mode);
             }
 
+            /* Other writers may be creating the same tags, wait for them and take what they made */
+            db.lock_tag_allocation(tx);
+
             /* Make sure we got everything */
-            std::vector<std::string_view> missing_tags;
+            std::vector<std::string_view> unresolved;
             for (std::string_view tag : tags) {
                 if (auto it = tag_ids.find(tag); it == tag_ids.end() || it->second <= 0) {
-                    /* Can't insert here, could invalidate iterators */
-                    missing_tags.push_back(tag);
+                    unresolved.push_back(tag);
                 }
             }
 
+            auto [created, missing_tags] = db.tag_ids(tx, unresolved);
+            for (auto& [name, id] : created) {
+                tag_ids.insert_or_assign(name, id);
+            }
+
             /* Generate new tag IDs for nonexistent tags */
-            int32_t next_tag = db.lowest_tag(tx) - 1;
+            int32_t next_tag = missing_tags.empty() ? 0 : db.allocate_tag_ids(tx, missing_tags.size());
             for (std::string_view new_tag : missing_tags) {
                 tag tag {
                     .id = next_tag--,
@@ -176,6 +435,8 @@ std::future<util::unordered_string_map<int32_t>> danbooru::fetch_and_insert_tags
 
         tx.commit();
 
+        /* Committed, safe to share with other tasks */
+        dictionary.insert(tag_ids);
 
         return tag_ids;
     });
@@ -12,6 +12,10 @@
 
 #include "danbooru_defs.hpp"
 #include "database.hpp"
+#include "tag_dictionary.hpp"
+#include "session_pool.hpp"
+#include "http_executor.hpp"
+#include "json_reader.hpp"
 
 namespace danbooru {
     struct page_selector {
@@ -34,18 +38,26 @@ namespace danbooru {
     };
 
     class api {
+        /* Scheme and host requests go to, without a trailing slash */
+        std::string _base_url;
+
         util::rate_limit _rl;
 
-        cpr::Authentication _auth;
+        session_pool _sessions;
+
+        /* Declared after the pool, outstanding jobs hold leases into it */
+        http_executor _executor;
+
         int32_t _user_id;
         std::string _user_name;
         user_level _level;
 
-        std::string _user_agent;
-
         public:
         api();
 
+        /* Log session usage and bytes per endpoint, new connections should stay near zero once warmed up */
+        void log_stats();
+
         [[nodiscard]] std::future<std::vector<tag>> tags(page_selector page, size_t limit = page_limit);
 
         template <typename T = json, typename Func = std::identity>
@@ -65,79 +77,71 @@ namespace danbooru {
 
         template <request_type Req, typename T = json, typename Func = std::identity> requires transform_func<T, Func>
         [[nodiscard]] std::future<T> request(std::string_view url, json params = {}, Func&& func = {}) {
-            return std::async([this](const cpr::Url& url, json params, Func func) -> T {
-                static std::array backoff { 100, 250, 250, 500, 500, 500, 1000, 1000, 1000, 1000 };
-
-                for (int32_t delay : backoff) {
-                    auto ses = std::make_shared<cpr::Session>();
-                    ses->SetAuth(_auth);
-                    ses->SetUrl(url);
-                    ses->SetUserAgent(_user_agent);
-
-                    if constexpr (Req == request_type::get) {
-                        cpr::Parameters res;
-                        for (auto& [key, val] : params) {
-                            res.Add(cpr::Parameter { key, val });
-                        }
-
-                        ses->SetParameters(res);
-                    } else {
-                        if constexpr (Req == request_type::get_as_post) {
-                            ses->SetHeader(cpr::Header {
-                                { "Content-Type", "application/json" },
-                                { "X-HTTP-Method-Override", "get" }
-                                });
-                        } else {
-                            ses->SetHeader(cpr::Header {
-                                { "Content-Type", "application/json" }
-                                });
-                        }
-
-                        std::string body = params.dump();
-                        // spdlog::trace("Body: {}", body);
-                        ses->SetBody(body);
-                    }
-
-                    _rl.acquire();
-
-                    cpr::Response res;
+            /* Only ask for what the result type declares */
+            if constexpr (json_reader::readable<T>) {
+                if (!params.contains("only")) {
+                    params["only"] = only_fields<T>;
+                }
+            }
 
-                    auto begin = clock::now();
+            /* Reused across requests, the pool keeps auth and user agent applied */
+            auto ses = _sessions.acquire(Req != request_type::get);
+            ses->SetUrl(cpr::Url { std::format("{}/{}.json", _base_url, url) });
 
-                    if constexpr (Req == request_type::get) {
-                        res = ses->Get();
-                    } else {
-                        res = ses->Post();
-                    }
+            if constexpr (Req == request_type::get) {
+                cpr::Parameters res;
+                for (auto& [key, val] : params) {
+                    res.Add(cpr::Parameter { key, val });
+                }
 
-                    std::chrono::nanoseconds elapsed = clock::now() - begin;
+                ses->SetParameters(res);
+                ses->SetHeader(cpr::Header {});
+            } else {
+                /* Session may have been used for a GET before */
+                ses->SetParameters(cpr::Parameters {});
+
+                if constexpr (Req == request_type::get_as_post) {
+                    ses->SetHeader(cpr::Header {
+                        { "Content-Type", "application/json" },
+                        { "X-HTTP-Method-Override", "get" }
+                        });
+                } else {
+                    ses->SetHeader(cpr::Header {
+                        { "Content-Type", "application/json" }
+                        });
+                }
 
-                    spdlog::trace("{}: {} - {} ({})",
-                        magic_enum::enum_name<Req>(),
-                        res.status_code,
-                        ses->GetFullRequestUrl(),
-                        elapsed
-                    );
+                std::string body = params.dump();
+                // spdlog::trace("Body: {}", body);
+                ses->SetBody(body);
+            }
 
-                    if (res.status_code == 0) {
-                        spdlog::warn("cURL error {}", magic_enum::enum_name(res.error.code));
-                        spdlog::warn("{} - {} ({})", magic_enum::enum_name<Req>(), ses->GetFullRequestUrl(), elapsed);
-                        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
-                        continue;
-                    }
+            /* Transfer runs on the executor, the transform runs in whichever thread waits for the result */
+            return std::async(std::launch::deferred,
+                [response = _executor.submit(std::move(ses), Req, std::string { url }), params = std::move(params), func = std::forward<Func>(func)]() mutable -> T {
+                    cpr::Response res = response.get();
 
                     if (res.status_code >= 400) {
                         throw std::runtime_error {
-                            std::format("{}: {} - {}\n{}", magic_enum::enum_name<Req>(), res.status_code, ses->GetFullRequestUrl(), res.text)
+                            std::format("{}: {} - {}\n{}", magic_enum::enum_name<Req>(), res.status_code, res.url.str(), res.text)
                         };
                     }
 
+                    /* Stream straight into the result, the DOM below stays as the fallback */
+                    if constexpr (std::same_as<std::remove_cvref_t<Func>, std::identity> && json_reader::readable<T>) {
+                        try {
+                            return json_reader::read<T>(res.text);
+                        } catch (const std::exception& e) {
+                            spdlog::warn("Streaming parse failed, retrying with DOM: {}", e.what());
+                        }
+                    }
+
                     try {
                         json j = json::parse(res.text);
                         return func(std::move(j));
                     } catch (const nlohmann::json::exception& e) {
                         spdlog::error("JSON exception: {}", e.what());
-                        spdlog::error("{}: {} - {}", magic_enum::enum_name<Req>(), res.status_code, ses->GetFullRequestUrl());
+                        spdlog::error("{}: {} - {}", magic_enum::enum_name<Req>(), res.status_code, res.url.str());
                         if (res.error) {
                             spdlog::error("cURL error {} {}",
                                 magic_enum::enum_name(res.error.code),
@@ -155,16 +159,14 @@ namespace danbooru {
 
                         throw;
                     }
-                }
-
-                throw std::runtime_error { std::format("Failed to fetch after {} tries, aborting", backoff.size()) };
-            }, std::format("https://danbooru.donmai.us/{}.json", url), std::move(params), std::forward<Func>(func));
+                });
         }
     };
 
-    /* Fetch tag IDs and insert them into the databse */
+    /* Fetch tag IDs and insert them into the databse, tags already in the dictionary are never looked up */
     [[nodiscard]] std::future<util::unordered_string_map<int32_t>> fetch_and_insert_tags(
-        api& booru, database::connection& db, const util::unordered_string_set& tags, database::insert_mode mode);
+        api& booru, database::connection& db, database::tag_dictionary& dictionary,
+        const util::unordered_string_set& tags, database::insert_mode mode);
 }
 
 #endif /* DANBOORU_HPP */
@@ -2,10 +2,12 @@
 #define DANBOORU_TYPES_HPP
 
 #include <chrono>
+#include <optional>
 
 #include <nlohmann/json.hpp>
 
 #include "util.hpp"
+#include "json_fields.hpp"
 
 namespace danbooru {
     using clock = std::chrono::utc_clock;
@@ -16,6 +18,15 @@ namespace danbooru {
 
     [[nodiscard]] timestamp parse_timestamp(std::string_view ts);
     [[nodiscard]] std::string format_timestamp(timestamp time);
+
+    /* "YYYY-MM-DDTHH:MM:SS.mmm+HH:MM" as the API sends it, without allocating. nullopt for any other shape */
+    [[nodiscard]] std::optional<timestamp> parse_timestamp_fixed(std::string_view ts);
+
+    /* Anything chrono::parse takes for "%FT%T%Ez", the epoch if it fails */
+    [[nodiscard]] timestamp parse_timestamp_generic(std::string_view ts);
+
+    /* Writes timestamp_length - 1 characters, no terminator, returns the end */
+    char* format_timestamp_to(char* dst, timestamp time);
 }
 
 NLOHMANN_JSON_NAMESPACE_BEGIN
@@ -125,7 +136,7 @@ namespace danbooru {
         timestamp created_at;
         timestamp updated_at;
     };
-    NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(tag, id, name, post_count, category, is_deprecated, created_at, updated_at)
+    DANBOORU_DEFINE_TYPE(tag, id, name, post_count, category, is_deprecated, created_at, updated_at)
 
     struct post {
         int32_t id;
@@ -159,7 +170,7 @@ namespace danbooru {
         int32_t height;
         file_type file_ext;
     };
-    NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(media_asset_variant, type, width, height, file_ext);
+    DANBOORU_DEFINE_TYPE(media_asset_variant, type, width, height, file_ext)
 
     struct media_asset {
         int32_t id;
@@ -177,7 +188,10 @@ namespace danbooru {
         timestamp created_at;
         timestamp updated_at;
     };
-    NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(media_asset, id, md5, file_ext, file_size, image_width, image_height, duration, pixel_hash)
+    DANBOORU_DEFINE_TYPE(media_asset,
+        id, md5, file_ext, file_size, image_width, image_height, duration, pixel_hash, status, file_key, is_public,
+        variants, created_at, updated_at
+    )
 
     struct post_version {
         int32_t id;
@@ -198,77 +212,61 @@ namespace danbooru {
         get_as_post,
     };
 
+    /* Scheduling class of a request, weighted against each other when tokens are handed out */
+    enum class request_priority {
+        /* Latency-sensitive, e.g. following the latest posts */
+        realtime,
+
+        /* Catching up on changes */
+        incremental,
+
+        /* Historical crawls, may wait */
+        backfill,
+    };
+
     enum class page_pos {
         absolute,
         before,
         after,
     };
 
+    /* Response structs only declare what we consume, their fields double as the "only" projection */
     namespace api_response {
         struct post {
             int32_t id;
-            timestamp created_at;
             int32_t uploader_id;
-            int32_t score;
-            std::string source;
-            std::string md5;
-            std::optional<timestamp> last_comment_bumped_at;
-            post_rating rating;
-            int32_t image_width;
-            int32_t image_height;
+            std::optional<int32_t> approver_id;
             std::string tag_string;
-            int32_t fav_count;
-            file_type file_ext;
-            std::optional<timestamp> last_noted_at;
+            post_rating rating;
             std::optional<int32_t> parent_id;
+            std::string source;
+            danbooru::media_asset media_asset;
+            int32_t fav_count;
             bool has_children;
-            std::optional<int32_t> approver_id;
-            int32_t tag_count_general;
-            int32_t tag_count_artist;
-            int32_t tag_count_character;
-            int32_t tag_count_copyright;
-            int64_t file_size;
             int32_t up_score;
             int32_t down_score;
             bool is_pending;
             bool is_flagged;
             bool is_deleted;
-            int32_t tag_count;
-            timestamp updated_at;
             bool is_banned;
             std::optional<int32_t> pixiv_id;
-            std::optional<timestamp> last_commented_at;
-            bool has_active_children;
             int32_t bit_flags;
-            int32_t tag_count_meta;
-            bool has_large;
-            bool has_visible_children;
-            media_asset media_asset;
-            std::string tag_string_general;
-            std::string tag_string_character;
-            std::string tag_string_copyright;
-            std::string tag_string_artist;
-            std::string tag_string_meta;
-            std::string file_url;
-            std::string large_file_url;
-            std::string preview_file_url;
+            std::optional<timestamp> last_commented_at;
+            std::optional<timestamp> last_comment_bumped_at;
+            std::optional<timestamp> last_noted_at;
+            timestamp created_at;
+            timestamp updated_at;
         };
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(post,
-            id, created_at, uploader_id, score, source, md5, last_comment_bumped_at, rating,
-            image_width, image_height, tag_string, fav_count, file_ext, last_noted_at, parent_id,
-            has_children, approver_id, tag_count_general, tag_count_artist, tag_count_character,
-            tag_count_copyright, file_size, up_score, down_score, is_pending, is_flagged,
-            is_deleted, tag_count, updated_at, is_banned, pixiv_id, last_commented_at,
-            has_active_children, bit_flags, tag_count_meta, has_large, has_visible_children,
-            media_asset, tag_string_general, tag_string_character, tag_string_copyright,
-            tag_string_artist, tag_string_meta, file_url, large_file_url, preview_file_url
+        DANBOORU_DEFINE_TYPE(post,
+            id, uploader_id, approver_id, tag_string, rating, parent_id, source, media_asset, fav_count,
+            has_children, up_score, down_score, is_pending, is_flagged, is_deleted, is_banned, pixiv_id,
+            bit_flags, last_commented_at, last_comment_bumped_at, last_noted_at, created_at, updated_at
         )
 
         struct post_version {
             int32_t id;
             int32_t post_id;
-            std::string tags;
             std::vector<std::string> added_tags;
             std::vector<std::string> removed_tags;
             std::optional<int32_t> updater_id;
@@ -280,15 +278,11 @@ namespace danbooru {
             std::string source;
             bool source_changed;
             int32_t version;
-            std::string obsolete_added_tags;
-            std::string obsolete_removed_tags;
-            std::string unchanged_tags;
         };
 
-        NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(post_version,
-            id, post_id, tags, added_tags, removed_tags, updater_id, updated_at, rating, rating_changed,
-            parent_id, parent_changed, source, source_changed, version, obsolete_added_tags,
-            obsolete_removed_tags, unchanged_tags
+        DANBOORU_DEFINE_TYPE(post_version,
+            id, post_id, added_tags, removed_tags, updater_id, updated_at, rating, rating_changed,
+            parent_id, parent_changed, source, source_changed, version
         )
     }
 }
@@ -1,9 +1,87 @@
 #include "database.hpp"
+#include "binary_params.hpp"
+
+#include <unordered_map>
 
 #include <spdlog/spdlog.h>
 
 using namespace database;
 
+namespace detail {
+    /* Arbitrary, only has to be unique among advisory locks taken on this database */
+    static constexpr int64_t tag_allocation_lock = 0x7461'6773;
+
+    /* Names per lookup query, keeps parameters and plans reasonably sized */
+    static constexpr size_t tag_lookup_chunk = 10000;
+
+    /* Metadata key of the next unused negative tag ID */
+    static constexpr std::string_view tag_allocator_key = "tag_allocator";
+
+    /* Every prepared statement, prepared on a connection the first time it's used there */
+    static const std::unordered_map<std::string_view, std::string_view> statements {
+        { "get_tag_id_by_name", "SELECT id FROM tags WHERE name = $1" },
+        { "get_tag_ids_by_names", "SELECT id, name FROM tags WHERE name = ANY($1::text[])" },
+        { "insert_media_asset", "INSERT INTO media_assets VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13)" },
+        { "insert_media_asset_variant", "INSERT INTO media_asset_variants VALUES ($1, $2, $3, $4, $5)" },
+        { "insert_post", "INSERT INTO posts VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14, $15, $16, $17, $18, $19, $20, $21, $22, $23)" },
+        { "insert_post_version", "INSERT INTO post_versions VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10)" },
+        { "latest_post_version_for_post", "SELECT COALESCE(MAX(id), 0) FROM post_versions WHERE post_id = $1" },
+        { "insert_tag_weak", "INSERT INTO tags VALUES ($1, $2, $3, $4, $5, $6, $7)" },
+        { "insert_tag_overwrite",
+            "INSERT INTO tags"
+            "  VALUES ($1, $2, $3, $4, $5, $6, $7)"
+            "  ON CONFLICT (id) DO UPDATE"
+            "    SET (name, post_count, category, is_deprecated, created_at, updated_at)"
+            "      = (EXCLUDED.name, EXCLUDED.post_count, EXCLUDED.category, EXCLUDED.is_deprecated, EXCLUDED.created_at, EXCLUDED.updated_at)" },
+        { "increment_post_count", "UPDATE tags SET post_count = post_count + $2 WHERE id = $1" },
+        { "lock_tags", "SELECT id FROM tags WHERE id = ANY($1::int[]) ORDER BY id FOR UPDATE" },
+        { "increment_post_counts",
+            "UPDATE tags SET post_count = tags.post_count + delta.count"
+            "  FROM unnest($1::int[], $2::int[]) AS delta(id, count)"
+            "  WHERE tags.id = delta.id" },
+        { "lock_posts", "SELECT id FROM posts WHERE id = ANY($1::int[]) ORDER BY id FOR UPDATE" },
+        { "post_tag_counts",
+            "SELECT tag, COUNT(*)::int FROM posts, unnest(posts.tags) AS tag"
+            "  WHERE posts.id = ANY($1::int[])"
+            "  GROUP BY tag" },
+        { "merge_post_staging",
+            "INSERT INTO posts SELECT * FROM post_staging ORDER BY id"
+            "  ON CONFLICT (id) DO UPDATE"
+            "    SET (uploader_id, approver_id, tags, rating, parent_id, source, media_asset, fav_count, has_children,"
+            "         up_score, down_score, is_pending, is_flagged, is_deleted, is_banned, pixiv_id, bit_flags,"
+            "         last_comment, last_bump, last_note, created_at, updated_at)"
+            "      = (EXCLUDED.uploader_id, EXCLUDED.approver_id, EXCLUDED.tags, EXCLUDED.rating, EXCLUDED.parent_id,"
+            "         EXCLUDED.source, EXCLUDED.media_asset, EXCLUDED.fav_count, EXCLUDED.has_children,"
+            "         EXCLUDED.up_score, EXCLUDED.down_score, EXCLUDED.is_pending, EXCLUDED.is_flagged,"
+            "         EXCLUDED.is_deleted, EXCLUDED.is_banned, EXCLUDED.pixiv_id, EXCLUDED.bit_flags,"
+            "         EXCLUDED.last_comment, EXCLUDED.last_bump, EXCLUDED.last_note, EXCLUDED.created_at, EXCLUDED.updated_at)" },
+        { "merge_media_asset_staging",
+            "INSERT INTO media_assets SELECT * FROM media_asset_staging ORDER BY id"
+            "  ON CONFLICT (id) DO UPDATE"
+            "    SET (md5, file_ext, file_size, image_width, image_height, duration, pixel_hash, status, file_key,"
+            "         is_public, created_at, updated_at)"
+            "      = (EXCLUDED.md5, EXCLUDED.file_ext, EXCLUDED.file_size, EXCLUDED.image_width, EXCLUDED.image_height,"
+            "         EXCLUDED.duration, EXCLUDED.pixel_hash, EXCLUDED.status, EXCLUDED.file_key, EXCLUDED.is_public,"
+            "         EXCLUDED.created_at, EXCLUDED.updated_at)" },
+        { "delete_staged_media_asset_variants",
+            "DELETE FROM media_asset_variants WHERE asset_id IN (SELECT id FROM media_asset_staging)" },
+        { "merge_media_asset_variant_staging",
+            "INSERT INTO media_asset_variants SELECT * FROM media_asset_variant_staging ORDER BY asset_id, type" },
+        { "get_post_hashes", "SELECT id, hash FROM post_hashes WHERE id = ANY($1::int[])" },
+        { "set_post_hashes",
+            "INSERT INTO post_hashes"
+            "  SELECT * FROM unnest($1::int[], $2::bigint[]) AS hashes(id, hash) ORDER BY id"
+            "  ON CONFLICT (id) DO UPDATE SET hash = EXCLUDED.hash" },
+        { "lock_tag_allocation", "SELECT pg_advisory_xact_lock($1)" },
+        { "get_metadata", "SELECT data FROM metadata WHERE key = $1" },
+        { "set_metadata",
+            "INSERT INTO metadata"
+            "  VALUES ($1, $2::jsonb)"
+            "  ON CONFLICT (key) DO UPDATE SET data = EXCLUDED.data" },
+        { "delete_metadata", "DELETE FROM metadata WHERE key = $1" },
+    };
+}
+
 namespace pqxx {
     zview string_traits<danbooru::timestamp>::to_buf(char* begin, char* end, const danbooru::timestamp& val) {
         char* new_end = into_buf(begin, end, val);
@@ -21,12 +99,11 @@ namespace pqxx {
             throw pqxx::conversion_overrun { std::format("failed to format timestamp: buffer size {} is too small", buf_size) };
         }
 
-        auto res = std::format_to_n(begin, buf_size,
-            danbooru::timestamp_format, std::chrono::time_point_cast<std::chrono::milliseconds>(val));
+        char* out = danbooru::format_timestamp_to(begin, val);
 
-        *res.out = '\0';
+        *out = '\0';
 
-        return res.out;
+        return out;
     }
 
     std::size_t string_traits<danbooru::timestamp>::size_buffer(const danbooru::timestamp& value) noexcept {
@@ -41,21 +118,6 @@ namespace pqxx {
 
 connection::connection() {
     spdlog::debug("Connected to {} as {}", _conn.dbname(), _conn.username());
-
-    _conn.prepare("get_tag_id_by_name", "SELECT id FROM tags WHERE name = $1");
-    _conn.prepare("insert_media_asset", "INSERT INTO media_assets VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13)");
-    _conn.prepare("insert_media_asset_variant", "INSERT INTO media_asset_variants VALUES ($1, $2, $3, $4, $5)");
-    _conn.prepare("insert_post", "INSERT INTO posts VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14, $15, $16, $17, $18, $19, $20, $21, $22, $23)");
-    _conn.prepare("insert_post_version", "INSERT INTO post_versions VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10)");
-    _conn.prepare("latest_post_version_for_post", "SELECT COALESCE(MAX(id), 0) FROM post_versions WHERE post_id = $1");
-    _conn.prepare("insert_tag_weak", "INSERT INTO tags VALUES ($1, $2, $3, $4, $5, $6, $7)");
-    _conn.prepare("insert_tag_overwrite",
-        "INSERT INTO tags"
-        "  VALUES ($1, $2, $3, $4, $5, $6, $7)"
-        "  ON CONFLICT (id) DO UPDATE"
-        "    SET (name, post_count, category, is_deprecated, created_at, updated_at)"
-        "      = (EXCLUDED.name, EXCLUDED.post_count, EXCLUDED.category, EXCLUDED.is_deprecated, EXCLUDED.created_at, EXCLUDED.updated_at)");
-    _conn.prepare("increment_post_count", "UPDATE tags SET post_count = post_count + $2 WHERE id = $1");
 }
 
 connection::~connection() {
@@ -81,7 +143,7 @@ pqxx::work connection::work() {
 }
 
 int32_t connection::insert(pqxx::work& tx, const danbooru::tag& tag, insert_mode mode) {
-    tx.exec_prepared0(mode == insert_mode::weak ? "insert_tag_weak" : "insert_tag_overwrite",
+    tx.exec_prepared0(_statement(mode == insert_mode::weak ? "insert_tag_weak" : "insert_tag_overwrite"),
         tag.id,
         tag.name,
         tag.post_count,
@@ -95,7 +157,7 @@ int32_t connection::insert(pqxx::work& tx, const danbooru::tag& tag, insert_mode
 }
 
 int32_t connection::insert(pqxx::work& tx, const danbooru::post& post) {
-    tx.exec_prepared0("insert_post",
+    tx.exec_prepared0(_statement("insert_post"), binary::params {
         post.id,
         post.uploader_id,
         post.approver_id,
@@ -119,14 +181,199 @@ int32_t connection::insert(pqxx::work& tx, const danbooru::post& post) {
         post.last_note,
         post.created_at,
         post.updated_at
-    );
+    }.get());
 
     return post.id;
 }
 
+void connection::insert(pqxx::work& tx, std::span<const danbooru::post> posts) {
+    if (posts.empty()) {
+        return;
+    }
+
+    _copy_posts(tx, "posts", posts);
+}
+
+void connection::upsert(pqxx::work& tx, std::span<const danbooru::post> posts) {
+    if (posts.empty()) {
+        return;
+    }
+
+    /* COPY can't resolve conflicts, stage the batch and merge it in one statement.
+     * Rows only clear on commit, an earlier call in this transaction would otherwise be merged again */
+    if (tx.query_value<bool>("SELECT to_regclass('pg_temp.post_staging') IS NULL")) {
+        tx.exec0("CREATE TEMP TABLE post_staging (LIKE posts) ON COMMIT DELETE ROWS");
+    } else {
+        tx.exec0("TRUNCATE post_staging");
+    }
+
+    _copy_posts(tx, "post_staging", posts);
+
+    tx.exec_prepared0(_statement("merge_post_staging"));
+}
+
+void connection::insert(pqxx::work& tx, std::span<const danbooru::media_asset> assets) {
+    if (assets.empty()) {
+        return;
+    }
+
+    _copy_media_assets(tx, "media_assets", "media_asset_variants", assets);
+}
+
+void connection::upsert(pqxx::work& tx, std::span<const danbooru::media_asset> assets) {
+    if (assets.empty()) {
+        return;
+    }
+
+    /* Emptied first like post_staging, they only clear on commit */
+    if (tx.query_value<bool>("SELECT to_regclass('pg_temp.media_asset_staging') IS NULL")) {
+        tx.exec0("CREATE TEMP TABLE media_asset_staging (LIKE media_assets) ON COMMIT DELETE ROWS");
+        tx.exec0("CREATE TEMP TABLE media_asset_variant_staging (LIKE media_asset_variants) ON COMMIT DELETE ROWS");
+    } else {
+        tx.exec0("TRUNCATE media_asset_staging, media_asset_variant_staging");
+    }
+
+    _copy_media_assets(tx, "media_asset_staging", "media_asset_variant_staging", assets);
+
+    /* Variants can disappear, replace each asset's set as a whole */
+    tx.exec_prepared0(_statement("merge_media_asset_staging"));
+    tx.exec_prepared0(_statement("delete_staged_media_asset_variants"));
+    tx.exec_prepared0(_statement("merge_media_asset_variant_staging"));
+}
+
+std::map<int32_t, int32_t> connection::post_tag_counts(pqxx::work& tx, std::span<const int32_t> post_ids) {
+    std::map<int32_t, int32_t> res;
+    if (post_ids.empty()) {
+        return res;
+    }
+
+    std::vector<int32_t> ids { post_ids.begin(), post_ids.end() };
+
+    /* Nobody else may change these tags until the counts are reconciled */
+    tx.exec_prepared(_statement("lock_posts"), binary::params { ids }.get());
+
+    for (const pqxx::row& row : tx.exec_prepared(_statement("post_tag_counts"), binary::params { ids }.get())) {
+        res.emplace(row[0].as<int32_t>(), row[1].as<int32_t>());
+    }
+
+    return res;
+}
+
+std::unordered_map<int32_t, int64_t> connection::post_hashes(pqxx::work& tx, std::span<const int32_t> post_ids) {
+    std::unordered_map<int32_t, int64_t> res;
+    res.reserve(post_ids.size());
+
+    std::vector<int32_t> ids { post_ids.begin(), post_ids.end() };
+    for (const pqxx::row& row : tx.exec_prepared(_statement("get_post_hashes"), binary::params { ids }.get())) {
+        res.emplace(row[0].as<int32_t>(), row[1].as<int64_t>());
+    }
+
+    return res;
+}
+
+void connection::set_post_hashes(pqxx::work& tx, std::span<const int32_t> post_ids, std::span<const int64_t> hashes) {
+    if (post_ids.empty()) {
+        return;
+    }
+
+    std::vector<int32_t> ids { post_ids.begin(), post_ids.end() };
+    std::vector<int64_t> values { hashes.begin(), hashes.end() };
+
+    tx.exec_prepared0(_statement("set_post_hashes"), binary::params { ids, values }.get());
+}
+
+std::optional<danbooru::timestamp> connection::latest_post_update(pqxx::work& tx) {
+    /* Timestamps are stored as UTC wall time, read as microseconds to skip text parsing */
+    auto micros = tx.query_value<std::optional<int64_t>>("SELECT (EXTRACT(EPOCH FROM MAX(updated_at)) * 1000000)::bigint FROM posts");
+    if (!micros) {
+        return std::nullopt;
+    }
+
+    return std::chrono::clock_cast<danbooru::clock>(std::chrono::sys_time<std::chrono::microseconds> { std::chrono::microseconds(*micros) });
+}
+
+void connection::_copy_posts(pqxx::work& tx, std::string_view table, std::span<const danbooru::post> posts) {
+    auto stream = pqxx::stream_to::table(tx, { table }, {
+        "id", "uploader_id", "approver_id", "tags", "rating", "parent_id", "source", "media_asset",
+        "fav_count", "has_children", "up_score", "down_score", "is_pending", "is_flagged", "is_deleted",
+        "is_banned", "pixiv_id", "bit_flags", "last_comment", "last_bump", "last_note", "created_at", "updated_at"
+    });
+
+    for (const danbooru::post& post : posts) {
+        stream.write_values(
+            post.id,
+            post.uploader_id,
+            post.approver_id,
+            post.tags,
+            post.rating,
+            post.parent,
+            post.source.empty() ? std::nullopt : std::optional { post.source },
+            post.media_asset,
+            post.fav_count,
+            post.has_children,
+            post.up_score,
+            post.down_score,
+            post.is_pending,
+            post.is_flagged,
+            post.is_deleted,
+            post.is_banned,
+            post.pixiv_id,
+            post.bit_flags,
+            post.last_comment,
+            post.last_bump,
+            post.last_note,
+            post.created_at,
+            post.updated_at
+        );
+    }
+
+    stream.complete();
+}
+
+void connection::_copy_media_assets(pqxx::work& tx, std::string_view assets_table, std::string_view variants_table,
+    std::span<const danbooru::media_asset> assets) {
+    {
+        auto stream = pqxx::stream_to::table(tx, { assets_table }, {
+            "id", "md5", "file_ext", "file_size", "image_width", "image_height", "duration", "pixel_hash",
+            "status", "file_key", "is_public", "created_at", "updated_at"
+        });
+
+        for (const danbooru::media_asset& asset : assets) {
+            stream.write_values(
+                asset.id,
+                asset.md5,
+                asset.file_ext,
+                asset.file_size,
+                asset.image_width,
+                asset.image_height,
+                asset.duration,
+                asset.pixel_hash,
+                asset.status,
+                asset.file_key,
+                asset.is_public,
+                asset.created_at,
+                asset.updated_at
+            );
+        }
+
+        stream.complete();
+    }
+
+    /* Variants reference their asset, so they go second */
+    auto stream = pqxx::stream_to::table(tx, { variants_table }, { "asset_id", "type", "width", "height", "file_ext" });
+
+    for (const danbooru::media_asset& asset : assets) {
+        for (const danbooru::media_asset_variant& variant : asset.variants) {
+            stream.write_values(asset.id, variant.type, variant.width, variant.height, variant.file_ext);
+        }
+    }
+
+    stream.complete();
+}
+
 int32_t connection::insert(pqxx::work& tx, const danbooru::media_asset& asset) {
     /* First insert asset, then versions */
-    tx.exec_prepared0("insert_media_asset",
+    tx.exec_prepared0(_statement("insert_media_asset"),
         asset.id,
         asset.md5,
         asset.file_ext,
@@ -143,7 +390,7 @@ int32_t connection::insert(pqxx::work& tx, const danbooru::media_asset& asset) {
     );
 
     for (const danbooru::media_asset_variant& variant : asset.variants) {
-        tx.exec_prepared0("insert_media_asset_variant",
+        tx.exec_prepared0(_statement("insert_media_asset_variant"),
             asset.id,
             variant.type,
             variant.width,
@@ -156,7 +403,7 @@ int32_t connection::insert(pqxx::work& tx, const danbooru::media_asset& asset) {
 }
 
 int32_t connection::insert(pqxx::work& tx, const danbooru::post_version& version) {
-    tx.exec_prepared0("insert_post_version",
+    tx.exec_prepared0(_statement("insert_post_version"), binary::params {
         version.id,
         version.post_id,
         version.updater_id,
@@ -167,13 +414,61 @@ int32_t connection::insert(pqxx::work& tx, const danbooru::post_version& version
         version.new_rating,
         version.new_parent,
         version.new_source
-    );
+    }.get());
 
     return version.id;
 }
 
+void connection::insert(pqxx::work& tx, std::span<const danbooru::post_version> versions) {
+    if (versions.empty()) {
+        return;
+    }
+
+    auto stream = pqxx::stream_to::table(tx, { "post_versions" }, {
+        "id", "post_id", "updater_id", "updated_at", "version",
+        "added_tags", "removed_tags", "new_rating", "new_parent", "new_source"
+    });
+
+    for (const danbooru::post_version& version : versions) {
+        stream.write_values(
+            version.id,
+            version.post_id,
+            version.updater_id,
+            version.updated_at,
+            version.version,
+            version.added_tags.empty() ? std::nullopt : std::optional { version.added_tags },
+            version.removed_tags.empty() ? std::nullopt : std::optional { version.removed_tags },
+            version.new_rating,
+            version.new_parent,
+            version.new_source
+        );
+    }
+
+    stream.complete();
+}
+
 void connection::increment_post_count(pqxx::work& tx, int32_t tag_id, int32_t count) {
-    tx.exec_prepared0("increment_post_count", tag_id, count);
+    tx.exec_prepared0(_statement("increment_post_count"), tag_id, count);
+}
+
+void connection::increment_post_counts(pqxx::work& tx, const std::map<int32_t, int32_t>& counts) {
+    if (counts.empty()) {
+        return;
+    }
+
+    std::vector<int32_t> ids;
+    std::vector<int32_t> deltas;
+    ids.reserve(counts.size());
+    deltas.reserve(counts.size());
+
+    for (const auto& [id, count] : counts) {
+        ids.push_back(id);
+        deltas.push_back(count);
+    }
+
+    /* The UPDATE's join order is up to the planner, lock rows in a known order first */
+    tx.exec_prepared(_statement("lock_tags"), binary::params { ids }.get());
+    tx.exec_prepared0(_statement("increment_post_counts"), binary::params { ids, deltas }.get());
 }
 
 int32_t connection::latest_post() {
@@ -185,7 +480,7 @@ int32_t connection::latest_tag() {
 }
 
 int32_t connection::latest_media_asset() {
-    return _table_max_id("post_versions");
+    return _table_max_id("media_assets");
 }
 
 int32_t connection::latest_post_version() {
@@ -194,7 +489,7 @@ int32_t connection::latest_post_version() {
 
 int32_t connection::latest_post_version(int32_t post_id) {
     auto tx = work();
-    int32_t res = tx.exec_prepared1("latest_post_version_for_post", post_id).at(0).as<int32_t>();
+    int32_t res = tx.exec_prepared1(_statement("latest_post_version_for_post"), post_id).at(0).as<int32_t>();
     tx.commit();
     return res;
 }
@@ -211,7 +506,7 @@ int32_t connection::lowest_tag(pqxx::work& tx) {
 }
 
 int32_t connection::tag_id(pqxx::work& tx, std::string_view tag_name) {
-    auto rows = tx.exec_prepared("get_tag_id_by_name", tag_name);
+    auto rows = tx.exec_prepared(_statement("get_tag_id_by_name"), binary::params { tag_name }.get());
 
     if (rows.empty()) {
         return 0;
@@ -224,6 +519,99 @@ int32_t connection::tag_id(pqxx::work& tx, std::string_view tag_name) {
     }
 }
 
+void connection::lock_tag_allocation(pqxx::work& tx) {
+    tx.exec_prepared1(_statement("lock_tag_allocation"), detail::tag_allocation_lock);
+}
+
+std::optional<nlohmann::json> connection::metadata(pqxx::work& tx, std::string_view key) {
+    auto rows = tx.exec_prepared(_statement("get_metadata"), key);
+
+    if (rows.empty()) {
+        return std::nullopt;
+    }
+
+    return nlohmann::json::parse(rows.at(0).at(0).view());
+}
+
+void connection::set_metadata(pqxx::work& tx, std::string_view key, const nlohmann::json& value) {
+    tx.exec_prepared0(_statement("set_metadata"), key, value.dump());
+}
+
+void connection::delete_metadata(pqxx::work& tx, std::string_view key) {
+    tx.exec_prepared0(_statement("delete_metadata"), key);
+}
+
+tag_lookup connection::tag_ids(pqxx::work& tx, const util::unordered_string_set& names) {
+    std::vector<std::string_view> views { names.begin(), names.end() };
+    return tag_ids(tx, views);
+}
+
+tag_lookup connection::tag_ids(pqxx::work& tx, std::span<const std::string_view> names) {
+    tag_lookup res;
+    res.ids.reserve(names.size());
+
+    for (const auto& chunk : names | std::views::chunk(detail::tag_lookup_chunk)) {
+        std::vector<std::string_view> batch { chunk.begin(), chunk.end() };
+
+        for (const pqxx::row& row : tx.exec_prepared(_statement("get_tag_ids_by_names"), binary::params { batch }.get())) {
+            res.ids.emplace(row[1].view(), row[0].as<int32_t>());
+        }
+    }
+
+    for (std::string_view name : names) {
+        if (!res.ids.contains(name)) {
+            res.missing.push_back(name);
+        }
+    }
+
+    return res;
+}
+
+pqxx::zview connection::_statement(std::string_view name) {
+    auto it = detail::statements.find(name);
+    if (it == detail::statements.end()) {
+        throw std::invalid_argument { std::format("Unknown statement \"{}\"", name) };
+    }
+
+    /* Keys are literals, so they're null-terminated */
+    pqxx::zview res { it->first.data(), it->first.size() };
+
+    if (!_prepared.contains(it->first)) {
+        _conn.prepare(res, pqxx::zview { it->second.data(), it->second.size() });
+        _prepared.insert(it->first);
+    }
+
+    return res;
+}
+
+std::optional<int32_t> connection::cursor(pqxx::work& tx, std::string_view key) {
+    std::optional data = metadata(tx, key);
+    if (!data) {
+        return std::nullopt;
+    }
+
+    return data->at("cursor").get<int32_t>();
+}
+
+void connection::set_cursor(pqxx::work& tx, std::string_view key, int32_t value) {
+    set_metadata(tx, key, { { "cursor", value } });
+}
+
+int32_t connection::allocate_tag_ids(pqxx::work& tx, size_t count) {
+    int32_t next;
+
+    if (std::optional data = metadata(tx, detail::tag_allocator_key)) {
+        next = data->at("next").get<int32_t>();
+    } else {
+        /* First allocation, continue below whatever exists */
+        next = std::min(lowest_tag(tx), 0) - 1;
+    }
+
+    set_metadata(tx, detail::tag_allocator_key, { { "next", next - static_cast<int32_t>(count) } });
+
+    return next;
+}
+
 int32_t connection::_table_max_id(std::string_view table) {
     auto tx = work();
     int32_t res = _table_max_id(tx, table);
@@ -5,8 +5,13 @@
 #include <cstdint>
 #include <string>
 #include <chrono>
+#include <optional>
 #include <mutex>
 #include <ranges>
+#include <span>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 
 #include <magic_enum.hpp>
@@ -90,9 +95,20 @@ namespace database {
         /* Overwrite on conflict */
         overwrite,
     };
+    /* Tag names resolved in bulk */
+    struct tag_lookup {
+        util::unordered_string_map<int32_t> ids;
+
+        /* Names without a row, viewing the caller's strings */
+        std::vector<std::string_view> missing;
+    };
+
     class connection {
         pqxx::connection _conn;
 
+        /* Statements already prepared on this connection */
+        std::unordered_set<std::string_view> _prepared;
+
         public:
         connection();
         ~connection();
@@ -112,11 +128,35 @@ namespace database {
 
         int32_t insert(pqxx::work& tx, const danbooru::tag& tag, insert_mode mode);
         int32_t insert(pqxx::work& tx, const danbooru::post& post);
+
+        /* Stream a batch through COPY, a single round trip no matter the size */
+        void insert(pqxx::work& tx, std::span<const danbooru::post> posts);
+
+        /* Insert or overwrite a batch, staged through COPY */
+        void upsert(pqxx::work& tx, std::span<const danbooru::post> posts);
+
+        /* How often each tag is used by the given posts, locking the posts */
+        [[nodiscard]] std::map<int32_t, int32_t> post_tag_counts(pqxx::work& tx, std::span<const int32_t> post_ids);
+
+        /* Stored content hash of each post that has one */
+        [[nodiscard]] std::unordered_map<int32_t, int64_t> post_hashes(pqxx::work& tx, std::span<const int32_t> post_ids);
+        void set_post_hashes(pqxx::work& tx, std::span<const int32_t> post_ids, std::span<const int64_t> hashes);
+
+        [[nodiscard]] std::optional<danbooru::timestamp> latest_post_update(pqxx::work& tx);
         int32_t insert(pqxx::work& tx, const danbooru::media_asset& asset);
+
+        /* Assets and their variants, each table streamed through one COPY */
+        void insert(pqxx::work& tx, std::span<const danbooru::media_asset> assets);
+        void upsert(pqxx::work& tx, std::span<const danbooru::media_asset> assets);
+
         int32_t insert(pqxx::work& tx, const danbooru::post_version& version);
+        void insert(pqxx::work& tx, std::span<const danbooru::post_version> versions);
 
         void increment_post_count(pqxx::work& tx, int32_t tag_id, int32_t count = 1);
 
+        /* Apply all deltas in one statement, row locks are taken in ID order so concurrent writers can't deadlock */
+        void increment_post_counts(pqxx::work& tx, const std::map<int32_t, int32_t>& counts);
+
         [[nodiscard]] int32_t latest_post();
         [[nodiscard]] int32_t latest_tag();
         [[nodiscard]] int32_t latest_media_asset();
@@ -129,7 +169,33 @@ namespace database {
 
         [[nodiscard]] int32_t tag_id(pqxx::work& tx, std::string_view tag_name);
 
+        /* Resolve many names in a few set-based queries instead of one query per name */
+        [[nodiscard]] tag_lookup tag_ids(pqxx::work& tx, const util::unordered_string_set& names);
+        [[nodiscard]] tag_lookup tag_ids(pqxx::work& tx, std::span<const std::string_view> names);
+
+        /* Serialize allocation of negative tag IDs until the transaction ends */
+        void lock_tag_allocation(pqxx::work& tx);
+
+        /* Value stored under key in the metadata table */
+        [[nodiscard]] std::optional<nlohmann::json> metadata(pqxx::work& tx, std::string_view key);
+        void set_metadata(pqxx::work& tx, std::string_view key, const nlohmann::json& value);
+        void delete_metadata(pqxx::work& tx, std::string_view key);
+
+        /* Where a task left off, a key lookup instead of scanning the table it fills */
+        [[nodiscard]] std::optional<int32_t> cursor(pqxx::work& tx, std::string_view key);
+        void set_cursor(pqxx::work& tx, std::string_view key, int32_t value);
+
+        /* Reserve count negative tag IDs, returns the highest. Needs lock_tag_allocation */
+        [[nodiscard]] int32_t allocate_tag_ids(pqxx::work& tx, size_t count);
+
         private:
+        /* Prepare on first use, returns the name to execute */
+        [[nodiscard]] pqxx::zview _statement(std::string_view name);
+
+        void _copy_posts(pqxx::work& tx, std::string_view table, std::span<const danbooru::post> posts);
+        void _copy_media_assets(pqxx::work& tx, std::string_view assets_table, std::string_view variants_table,
+            std::span<const danbooru::media_asset> assets);
+
         [[nodiscard]] int32_t _table_max_id(std::string_view table);
         [[nodiscard]] int32_t _table_max_id(pqxx::work& tx, std::string_view table);
     };
@@ -0,0 +1,131 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "database_pool.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+#include <logging.hpp>
+#include <util.hpp>
+
+using namespace database;
+
+pool::lease::lease(pool* pool, std::unique_ptr<connection> conn) : _pool { pool }, _conn { std::move(conn) } {
+
+}
+
+pool::lease::~lease() {
+    _release();
+}
+
+pool::lease::lease(lease&& other) noexcept
+    : _pool { std::exchange(other._pool, nullptr) }, _conn { std::move(other._conn) } {
+
+}
+
+pool::lease& pool::lease::operator=(lease&& other) noexcept {
+    if (this != &other) {
+        _release();
+        _pool = std::exchange(other._pool, nullptr);
+        _conn = std::move(other._conn);
+    }
+
+    return *this;
+}
+
+connection* pool::lease::operator->() {
+    return _conn.get();
+}
+
+connection& pool::lease::operator*() {
+    return *_conn;
+}
+
+void pool::lease::_release() {
+    if (_pool && _conn) {
+        _pool->_release(std::move(_conn));
+    }
+
+    _pool = nullptr;
+}
+
+pool::pool(size_t size) : _size { size } {
+    if (size == 0) {
+        throw std::invalid_argument { "Connection pool needs at least one connection" };
+    }
+}
+
+pool::lease pool::acquire() {
+    auto begin = clock_type::now();
+
+    std::unique_lock lock { _lock };
+
+    bool waited = false;
+    while (_idle.empty() && _open >= _size) {
+        waited = true;
+        _available.wait(lock);
+    }
+
+    duration elapsed = clock_type::now() - begin;
+
+    _waits.checkouts += 1;
+    _waits.total += elapsed;
+    _waits.max = std::max(_waits.max, elapsed);
+    if (waited) {
+        _waits.waited += 1;
+    }
+
+    if (!_idle.empty()) {
+        std::unique_ptr<connection> conn = std::move(_idle.back());
+        _idle.pop_back();
+
+        return { this, std::move(conn) };
+    }
+
+    /* Connect outside the lock, it's a network round trip */
+    _open += 1;
+    lock.unlock();
+
+    try {
+        return { this, std::make_unique<connection>() };
+    } catch (...) {
+        lock.lock();
+        _open -= 1;
+        _available.notify_one();
+        throw;
+    }
+}
+
+size_t pool::size() const {
+    return _size;
+}
+
+pool::wait_stats pool::waits() {
+    std::unique_lock lock { _lock };
+    return _waits;
+}
+
+void pool::log_stats() {
+    wait_stats stats = waits();
+    if (stats.checkouts == 0) {
+        return;
+    }
+
+    spdlog::info("Database pool: {} checkouts, {} waited, {} on average, {} at most",
+        stats.checkouts, stats.waited,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stats.total / stats.checkouts),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stats.max)
+    );
+}
+
+void pool::_release(std::unique_ptr<connection> conn) {
+    std::unique_lock lock { _lock };
+
+    /* Broken connections are dropped, a new one is opened when needed */
+    if (conn->conn().is_open()) {
+        _idle.push_back(std::move(conn));
+    } else {
+        _open -= 1;
+    }
+
+    _available.notify_one();
+}
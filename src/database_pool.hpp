@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef DATABASE_POOL_HPP
+#define DATABASE_POOL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "database.hpp"
+
+namespace database {
+    /* Connections shared between tasks and their workers, opened on demand up to a fixed size */
+    class pool {
+        public:
+        using clock_type = std::chrono::steady_clock;
+        using duration = clock_type::duration;
+
+        /* Time spent waiting for a free connection */
+        struct wait_stats {
+            uint64_t checkouts = 0;
+            uint64_t waited = 0;
+            duration total = duration::zero();
+            duration max = duration::zero();
+        };
+
+        /* Exclusive use of a connection, returned to the pool on destruction */
+        class lease {
+            friend class pool;
+
+            pool* _pool;
+            std::unique_ptr<connection> _conn;
+
+            lease(pool* pool, std::unique_ptr<connection> conn);
+
+            public:
+            ~lease();
+
+            lease(const lease&) = delete;
+            lease& operator=(const lease&) = delete;
+
+            lease(lease&& other) noexcept;
+            lease& operator=(lease&& other) noexcept;
+
+            connection* operator->();
+            connection& operator*();
+
+            private:
+            void _release();
+        };
+
+        private:
+        size_t _size;
+
+        std::mutex _lock;
+        std::condition_variable _available;
+
+        std::vector<std::unique_ptr<connection>> _idle;
+
+        /* Connections that exist, idle or leased */
+        size_t _open = 0;
+
+        wait_stats _waits;
+
+        public:
+        explicit pool(size_t size);
+
+        pool(const pool&) = delete;
+        pool& operator=(const pool&) = delete;
+
+        /* Blocks while every connection is leased */
+        [[nodiscard]] lease acquire();
+
+        [[nodiscard]] size_t size() const;
+
+        [[nodiscard]] wait_stats waits();
+
+        void log_stats();
+
+        private:
+        void _release(std::unique_ptr<connection> conn);
+    };
+}
+
+#endif /* DATABASE_POOL_HPP */
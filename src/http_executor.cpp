@@ -0,0 +1,309 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "http_executor.hpp"
+
+#include <array>
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <utility>
+
+#include <magic_enum.hpp>
+
+#include <logging.hpp>
+#include <util.hpp>
+
+using namespace danbooru;
+
+namespace detail {
+    static constexpr std::array backoff {
+        std::chrono::milliseconds(100), std::chrono::milliseconds(250), std::chrono::milliseconds(250),
+        std::chrono::milliseconds(500), std::chrono::milliseconds(500), std::chrono::milliseconds(500),
+        std::chrono::milliseconds(1000), std::chrono::milliseconds(1000), std::chrono::milliseconds(1000),
+        std::chrono::milliseconds(1000),
+    };
+
+    /* Upper bound on a single poll, submissions and stop requests wake the loop early */
+    static constexpr auto max_poll = std::chrono::seconds(1);
+
+    /* Used when a throttled response has no (or an HTTP-date) Retry-After */
+    static constexpr auto default_retry_after = std::chrono::seconds(1);
+
+    [[nodiscard]] static http_executor::duration retry_after(const cpr::Response& res) {
+        auto it = res.header.find("Retry-After");
+        if (it == res.header.end()) {
+            return default_retry_after;
+        }
+
+        int64_t seconds = 0;
+        auto [ptr, ec] = std::from_chars(it->second.data(), it->second.data() + it->second.size(), seconds);
+        if (ec != std::errc {} || seconds < 0) {
+            return default_retry_after;
+        }
+
+        return std::chrono::seconds(seconds);
+    }
+}
+
+namespace detail {
+    static thread_local request_priority current_priority = request_priority::realtime;
+}
+
+priority_scope::priority_scope(request_priority priority)
+    : _previous { std::exchange(detail::current_priority, priority) } {
+
+}
+
+priority_scope::~priority_scope() {
+    detail::current_priority = _previous;
+}
+
+request_priority priority_scope::current() {
+    return detail::current_priority;
+}
+
+http_executor::http_executor(util::rate_limit& rl, weights weights)
+    : _rl { rl }, _weights { weights }, _multi { curl_multi_init() } {
+    if (!_multi) {
+        throw std::runtime_error { "Failed to initialize cURL multi handle" };
+    }
+
+    /* Multiplex over a single connection when HTTP/2 is negotiated */
+    curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    _thread = std::jthread { [this](std::stop_token token) { _run(token); } };
+}
+
+http_executor::~http_executor() {
+    _thread.request_stop();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    /* Fail everything that was still outstanding */
+    auto abort = [](std::unique_ptr<job>& job) {
+        job->promise.set_exception(std::make_exception_ptr(std::runtime_error { "Request aborted, executor shut down" }));
+    };
+
+    for (auto& [handle, job] : _running) {
+        curl_multi_remove_handle(_multi, handle);
+        abort(job);
+    }
+
+    for (auto& queue : _waiting) {
+        std::ranges::for_each(queue, abort);
+    }
+
+    std::ranges::for_each(_delayed, abort);
+    std::ranges::for_each(_submitted, abort);
+
+    curl_multi_cleanup(_multi);
+}
+
+std::future<cpr::Response> http_executor::submit(session_pool::lease session, request_type type, std::string endpoint,
+    request_priority priority) {
+    auto res = std::make_unique<job>(std::move(session), type, std::move(endpoint), priority);
+    auto future = res->promise.get_future();
+
+    {
+        std::unique_lock lock { _lock };
+        _submitted.push_back(std::move(res));
+    }
+
+    curl_multi_wakeup(_multi);
+
+    return future;
+}
+
+util::unordered_string_map<http_executor::transfer_stats> http_executor::transfers() {
+    std::unique_lock lock { _stats_lock };
+    return _transfers;
+}
+
+std::array<http_executor::wait_stats, request_priority_count> http_executor::waits() {
+    std::unique_lock lock { _stats_lock };
+    return _waits;
+}
+
+void http_executor::_run(std::stop_token token) {
+    std::stop_callback wake { token, [this] { curl_multi_wakeup(_multi); } };
+
+    while (!token.stop_requested()) {
+        {
+            std::unique_lock lock { _lock };
+            for (std::unique_ptr<job>& job : _submitted) {
+                _waiting[magic_enum::enum_integer(job->priority)].push_back(std::move(job));
+            }
+
+            _submitted.clear();
+        }
+
+        duration timeout = _dispatch();
+
+        int running = 0;
+        curl_multi_perform(_multi, &running);
+
+        bool finished = false;
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(_multi, &queued)) {
+            if (msg->msg == CURLMSG_DONE) {
+                _finish(msg->easy_handle, msg->data.result);
+                finished = true;
+            }
+        }
+
+        /* Retries may be due, don't sleep on them */
+        if (finished) {
+            continue;
+        }
+
+        auto timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(timeout);
+        curl_multi_poll(_multi, nullptr, 0, static_cast<int>(timeout_ms.count()), nullptr);
+    }
+}
+
+http_executor::duration http_executor::_dispatch() {
+    duration timeout = detail::max_poll;
+
+    /* Retries that are due go first in their class */
+    auto now = clock_type::now();
+    for (auto it = _delayed.begin(); it != _delayed.end();) {
+        if ((*it)->not_before > now) {
+            timeout = std::min(timeout, (*it)->not_before - now);
+            ++it;
+        } else {
+            _waiting[magic_enum::enum_integer((*it)->priority)].push_front(std::move(*it));
+            it = _delayed.erase(it);
+        }
+    }
+
+    while (std::optional<request_priority> next = _next_class()) {
+        /* Nothing else can start until a token is available */
+        if (duration wait = _rl.try_acquire(); wait > duration::zero()) {
+            return std::min(timeout, wait);
+        }
+
+        size_t index = magic_enum::enum_integer(*next);
+
+        double start = std::max(_virtual_time, _finish_tags[index]);
+        _finish_tags[index] = start + 1. / _weights[index];
+        _virtual_time = start;
+
+        std::unique_ptr<job> job = std::move(_waiting[index].front());
+        _waiting[index].pop_front();
+
+        if (job->attempt == 0) {
+            duration waited = clock_type::now() - job->submitted;
+
+            std::unique_lock lock { _stats_lock };
+            wait_stats& stats = _waits[index];
+            stats.requests += 1;
+            stats.total += waited;
+            stats.max = std::max(stats.max, waited);
+        }
+
+        _start(std::move(job));
+    }
+
+    return timeout;
+}
+
+std::optional<request_priority> http_executor::_next_class() const {
+    std::optional<request_priority> res;
+    double lowest = 0;
+
+    for (size_t i = 0; i < request_priority_count; ++i) {
+        if (_waiting[i].empty()) {
+            continue;
+        }
+
+        /* Idle classes don't bank credit, they start at the current virtual time */
+        double start = std::max(_virtual_time, _finish_tags[i]);
+        if (!res || start < lowest) {
+            res = magic_enum::enum_value<request_priority>(i);
+            lowest = start;
+        }
+    }
+
+    return res;
+}
+
+void http_executor::_start(std::unique_ptr<job> job) {
+    cpr::Session& ses = *job->session;
+
+    if (job->type == request_type::get) {
+        ses.PrepareGet();
+    } else {
+        ses.PreparePost();
+    }
+
+    CURL* handle = ses.GetCurlHolder()->handle;
+
+    job->begin = clock_type::now();
+    curl_multi_add_handle(_multi, handle);
+    _running.emplace(handle, std::move(job));
+}
+
+void http_executor::_finish(CURL* handle, CURLcode result) {
+    auto node = _running.extract(handle);
+    curl_multi_remove_handle(_multi, handle);
+
+    std::unique_ptr<job>& job = node.mapped();
+
+    cpr::Response res = job->session->Complete(result);
+
+    std::chrono::nanoseconds elapsed = clock_type::now() - job->begin;
+    uint64_t connects = job->session.complete();
+
+    spdlog::trace("{}: {} - {} ({}, session #{}, {} new connections)",
+        magic_enum::enum_name(job->type),
+        res.status_code,
+        res.url.str(),
+        elapsed,
+        job->session.id(),
+        connects
+    );
+
+    if (res.status_code == 0) {
+        spdlog::warn("cURL error {}", magic_enum::enum_name(res.error.code));
+        spdlog::warn("{} - {} ({})", magic_enum::enum_name(job->type), res.url.str(), elapsed);
+
+        if (job->attempt >= detail::backoff.size()) {
+            job->promise.set_exception(std::make_exception_ptr(std::runtime_error {
+                std::format("Failed to fetch after {} tries, aborting", detail::backoff.size())
+            }));
+
+            return;
+        }
+
+        job->not_before = clock_type::now() + detail::backoff[job->attempt++];
+        _delayed.push_back(std::move(job));
+
+        return;
+    }
+
+    /* Server-side throttling, stop everyone for as long as we're told to */
+    if ((res.status_code == 429 || res.status_code == 503) && job->attempt < detail::backoff.size()) {
+        duration delay = detail::retry_after(res);
+
+        spdlog::warn("{} - {}: throttled, retrying in {}",
+            res.status_code, res.url.str(), std::chrono::duration_cast<std::chrono::nanoseconds>(delay));
+
+        _rl.penalize(delay);
+
+        job->attempt += 1;
+        job->not_before = clock_type::now() + delay;
+        _delayed.push_back(std::move(job));
+
+        return;
+    }
+
+    {
+        std::unique_lock lock { _stats_lock };
+        transfer_stats& stats = _transfers[job->endpoint];
+        stats.requests += 1;
+        stats.wire_bytes += res.downloaded_bytes;
+        stats.body_bytes += res.text.size();
+    }
+
+    job->promise.set_value(std::move(res));
+}
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef HTTP_EXECUTOR_HPP
+#define HTTP_EXECUTOR_HPP
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cpr/cpr.h>
+#include <magic_enum.hpp>
+
+#include <rate_limit.hpp>
+#include <util.hpp>
+
+#include "danbooru_defs.hpp"
+#include "session_pool.hpp"
+
+namespace danbooru {
+    static constexpr size_t request_priority_count = magic_enum::enum_count<request_priority>();
+
+    /* Priority of requests submitted from this thread while in scope */
+    class priority_scope {
+        request_priority _previous;
+
+        public:
+        explicit priority_scope(request_priority priority);
+        ~priority_scope();
+
+        priority_scope(const priority_scope&) = delete;
+        priority_scope& operator=(const priority_scope&) = delete;
+
+        [[nodiscard]] static request_priority current();
+    };
+
+    /* Runs every outstanding request on a single curl-multi loop */
+    class http_executor {
+        public:
+        using clock_type = std::chrono::steady_clock;
+        using duration = clock_type::duration;
+        using time_point = clock_type::time_point;
+
+        struct transfer_stats {
+            uint64_t requests = 0;
+
+            /* Response bodies as received, before content decoding */
+            uint64_t wire_bytes = 0;
+
+            /* Response bodies after decoding */
+            uint64_t body_bytes = 0;
+        };
+
+        /* Time between submission and the transfer starting */
+        struct wait_stats {
+            uint64_t requests = 0;
+            duration total = duration::zero();
+            duration max = duration::zero();
+        };
+
+        using weights = std::array<double, request_priority_count>;
+
+        private:
+        struct job {
+            session_pool::lease session;
+            request_type type;
+            std::string endpoint;
+            request_priority priority;
+            std::promise<cpr::Response> promise;
+
+            size_t attempt = 0;
+
+            time_point submitted = clock_type::now();
+
+            /* Retry backoff */
+            time_point not_before;
+            time_point begin;
+        };
+
+        util::rate_limit& _rl;
+        weights _weights;
+        CURLM* _multi;
+
+        std::mutex _lock;
+        std::vector<std::unique_ptr<job>> _submitted;
+
+        /* Only touched by the loop thread */
+        std::array<std::deque<std::unique_ptr<job>>, request_priority_count> _waiting;
+        std::deque<std::unique_ptr<job>> _delayed;
+        std::unordered_map<CURL*, std::unique_ptr<job>> _running;
+
+        /* Start-time fair queueing: system virtual time and the finish tag of each class */
+        double _virtual_time = 0;
+        std::array<double, request_priority_count> _finish_tags {};
+
+        std::mutex _stats_lock;
+        util::unordered_string_map<transfer_stats> _transfers;
+        std::array<wait_stats, request_priority_count> _waits {};
+
+        std::jthread _thread;
+
+        public:
+        http_executor(util::rate_limit& rl, weights weights);
+        ~http_executor();
+
+        http_executor(const http_executor&) = delete;
+        http_executor& operator=(const http_executor&) = delete;
+
+        /* Session must be fully set up except for the request method */
+        [[nodiscard]] std::future<cpr::Response> submit(session_pool::lease session, request_type type, std::string endpoint,
+            request_priority priority = priority_scope::current());
+
+        /* Bytes transferred per endpoint */
+        [[nodiscard]] util::unordered_string_map<transfer_stats> transfers();
+
+        /* Queueing delay per priority class */
+        [[nodiscard]] std::array<wait_stats, request_priority_count> waits();
+
+        private:
+        void _run(std::stop_token token);
+
+        /* Start due jobs while the rate limit allows, returns how long until the next one could start */
+        [[nodiscard]] duration _dispatch();
+
+        /* Backlogged class with the lowest start tag */
+        [[nodiscard]] std::optional<request_priority> _next_class() const;
+
+        void _start(std::unique_ptr<job> job);
+        void _finish(CURL* handle, CURLcode result);
+    };
+}
+
+#endif /* HTTP_EXECUTOR_HPP */
@@ -0,0 +1,138 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef JSON_FIELDS_HPP
+#define JSON_FIELDS_HPP
+
+#include <array>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace danbooru {
+    /* Named data member of a response struct */
+    template <typename Class, typename Member>
+    struct field {
+        using class_type = Class;
+        using member_type = Member;
+
+        std::string_view name;
+        Member Class::* member;
+    };
+
+    template <typename Class, typename Member>
+    [[nodiscard]] constexpr field<Class, Member> make_field(std::string_view name, Member Class::* member) {
+        return { name, member };
+    }
+
+    /* Types that declared their fields with DANBOORU_DEFINE_FIELDS, found through ADL */
+    template <typename T>
+    concept has_fields = requires {
+        danbooru_fields(std::type_identity<T> {});
+    };
+
+    template <has_fields T>
+    [[nodiscard]] constexpr auto fields_of() {
+        return danbooru_fields(std::type_identity<T> {});
+    }
+
+    namespace projection {
+        /* What a member projects to, containers project like their elements */
+        template <typename T>
+        struct projected {
+            using type = T;
+        };
+
+        template <typename T>
+        struct projected<std::optional<T>> : projected<T> { };
+
+        template <typename T>
+        struct projected<std::vector<T>> : projected<T> { };
+
+        template <typename T>
+        using projected_t = projected<T>::type;
+
+        struct counter {
+            size_t size = 0;
+
+            constexpr void append(std::string_view str) {
+                size += str.size();
+            }
+        };
+
+        template <size_t N>
+        struct buffer {
+            std::array<char, N> data {};
+            size_t size = 0;
+
+            constexpr void append(std::string_view str) {
+                for (char c : str) {
+                    data[size++] = c;
+                }
+            }
+        };
+
+        /* "a,b,nested[c,d]" */
+        template <has_fields T, typename Out>
+        constexpr void append(Out& out) {
+            bool first = true;
+            std::apply([&](const auto&... field) {
+                ([&] {
+                    using member = projected_t<typename std::remove_cvref_t<decltype(field)>::member_type>;
+
+                    if (!first) {
+                        out.append(",");
+                    }
+
+                    first = false;
+                    out.append(field.name);
+
+                    if constexpr (has_fields<member>) {
+                        out.append("[");
+                        append<member>(out);
+                        out.append("]");
+                    }
+                }(), ...);
+            }, fields_of<T>());
+        }
+
+        template <has_fields T>
+        [[nodiscard]] constexpr size_t size() {
+            counter res;
+            append<T>(res);
+            return res.size;
+        }
+
+        template <has_fields T>
+        inline constexpr auto storage = [] {
+            buffer<size<T>()> res;
+            append<T>(res);
+            return res.data;
+        }();
+    }
+
+    /* Value for the "only" parameter, so the server sends exactly the fields T declares */
+    template <typename T> requires has_fields<projection::projected_t<T>>
+    inline constexpr std::string_view only_fields {
+        projection::storage<projection::projected_t<T>>.data(),
+        projection::storage<projection::projected_t<T>>.size()
+    };
+}
+
+#define DANBOORU_FIELD(member) , std::tuple { ::danbooru::make_field(#member, &danbooru_fields_type::member) }
+
+/* Compile-time list of (name, member pointer) pairs, in declaration order */
+#define DANBOORU_DEFINE_FIELDS(Type, ...) \
+    [[maybe_unused]] constexpr auto danbooru_fields(std::type_identity<Type>) { \
+        using danbooru_fields_type = Type; \
+        return std::tuple_cat(std::tuple<> {} NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(DANBOORU_FIELD, __VA_ARGS__))); \
+    }
+
+/* nlohmann::json (de)serialization plus the field list used by the streaming reader */
+#define DANBOORU_DEFINE_TYPE(Type, ...) \
+    NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE_WITH_DEFAULT(Type, __VA_ARGS__) \
+    DANBOORU_DEFINE_FIELDS(Type, __VA_ARGS__)
+
+#endif /* JSON_FIELDS_HPP */
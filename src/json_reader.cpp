@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "json_reader.hpp"
+
+#include <utility>
+
+using namespace danbooru::json_reader;
+
+namespace detail {
+    /* Copy of the error as its most derived type, so it still matches catch (json::parse_error&) and friends */
+    [[nodiscard]] static std::exception_ptr capture(const nlohmann::json::exception& ex) {
+        if (auto* err = dynamic_cast<const nlohmann::json::parse_error*>(&ex)) {
+            return std::make_exception_ptr(*err);
+        }
+
+        if (auto* err = dynamic_cast<const nlohmann::json::invalid_iterator*>(&ex)) {
+            return std::make_exception_ptr(*err);
+        }
+
+        if (auto* err = dynamic_cast<const nlohmann::json::type_error*>(&ex)) {
+            return std::make_exception_ptr(*err);
+        }
+
+        if (auto* err = dynamic_cast<const nlohmann::json::out_of_range*>(&ex)) {
+            return std::make_exception_ptr(*err);
+        }
+
+        if (auto* err = dynamic_cast<const nlohmann::json::other_error*>(&ex)) {
+            return std::make_exception_ptr(*err);
+        }
+
+        return std::make_exception_ptr(std::runtime_error { ex.what() });
+    }
+}
+
+reader::reader(target root) : _root { root } {
+
+}
+
+bool reader::null() {
+    return _scalar(nullptr);
+}
+
+bool reader::boolean(bool val) {
+    return _scalar(val);
+}
+
+bool reader::number_integer(number_integer_t val) {
+    return _scalar(static_cast<int64_t>(val));
+}
+
+bool reader::number_unsigned(number_unsigned_t val) {
+    return _scalar(static_cast<uint64_t>(val));
+}
+
+bool reader::number_float(number_float_t val, const string_t&) {
+    return _scalar(static_cast<double>(val));
+}
+
+bool reader::string(string_t& val) {
+    return _scalar(&val);
+}
+
+bool reader::binary(binary_t&) {
+    /* Not produced by the JSON parser */
+    return _scalar(nullptr);
+}
+
+bool reader::start_object(std::size_t) {
+    if (_skip) {
+        ++_skip;
+        return true;
+    }
+
+    target dst = _value_target();
+    if (!dst.ops) {
+        _skip = 1;
+        return true;
+    }
+
+    _stack.push_back({ .dst = dst.ops->begin_object(dst.ptr), .is_array = false });
+    return true;
+}
+
+bool reader::key(string_t& val) {
+    if (!_skip) {
+        const frame& top = _stack.back();
+        _next = top.dst.ops->member(top.dst.ptr, val);
+    }
+
+    return true;
+}
+
+bool reader::end_object() {
+    if (_skip) {
+        --_skip;
+    } else {
+        _stack.pop_back();
+    }
+
+    return true;
+}
+
+bool reader::start_array(std::size_t) {
+    if (_skip) {
+        ++_skip;
+        return true;
+    }
+
+    target dst = _value_target();
+    if (!dst.ops) {
+        _skip = 1;
+        return true;
+    }
+
+    _stack.push_back({ .dst = dst.ops->begin_array(dst.ptr), .is_array = true });
+    return true;
+}
+
+bool reader::end_array() {
+    return end_object();
+}
+
+bool reader::parse_error(std::size_t, const std::string&, const nlohmann::json::exception& ex) {
+    /* Stop here, read() rethrows once sax_parse has returned */
+    _error = detail::capture(ex);
+    return false;
+}
+
+void reader::rethrow() const {
+    if (_error) {
+        std::rethrow_exception(_error);
+    }
+
+    throw std::runtime_error { "JSON parse stopped without an error" };
+}
+
+target reader::_value_target() {
+    if (_stack.empty()) {
+        return std::exchange(_root, {});
+    }
+
+    const frame& top = _stack.back();
+    if (top.is_array) {
+        return top.dst.ops->element(top.dst.ptr);
+    }
+
+    return std::exchange(_next, {});
+}
+
+bool reader::_scalar(scalar_value val) {
+    if (_skip) {
+        return true;
+    }
+
+    if (target dst = _value_target(); dst.ops) {
+        dst.ops->scalar(dst.ptr, val);
+    }
+
+    return true;
+}
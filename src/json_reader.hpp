@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef JSON_READER_HPP
+#define JSON_READER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <variant>
+#include <tuple>
+#include <stdexcept>
+#include <format>
+#include <type_traits>
+#include <exception>
+
+#include <nlohmann/json.hpp>
+#include <magic_enum.hpp>
+
+#include "danbooru_defs.hpp"
+#include "json_fields.hpp"
+
+/* Streaming (SAX) reader, fills response structs straight from the response body without building a DOM */
+namespace danbooru::json_reader {
+    using scalar_value = std::variant<std::nullptr_t, bool, int64_t, uint64_t, double, std::string*>;
+
+    struct type_ops;
+
+    /* Where the next value goes, a null target skips it */
+    struct target {
+        void* ptr = nullptr;
+        const type_ops* ops = nullptr;
+    };
+
+    struct type_ops {
+        void (*scalar)(void* dst, scalar_value val);
+
+        /* Start of an object or array, returns where its contents go */
+        target (*begin_object)(void* dst);
+        target (*begin_array)(void* dst);
+
+        /* Member of an object, or next element of an array */
+        target (*member)(void* dst, std::string_view key);
+        target (*element)(void* dst);
+    };
+
+    template <typename T>
+    struct is_vector : std::false_type { };
+
+    template <typename T>
+    struct is_vector<std::vector<T>> : std::true_type { };
+
+    template <typename T>
+    struct is_optional : std::false_type { };
+
+    template <typename T>
+    struct is_optional<std::optional<T>> : std::true_type { };
+
+    template <typename T>
+    concept scalar_type = std::same_as<T, bool> || std::integral<T> || std::floating_point<T>
+        || std::same_as<T, std::string> || std::same_as<T, timestamp> || std::is_enum_v<T>;
+
+    /* Top-level types read() accepts */
+    template <typename T>
+    concept readable = has_fields<T> || (is_vector<T>::value && has_fields<typename T::value_type>);
+
+    template <typename T>
+    [[nodiscard]] const type_ops& ops_for();
+
+    template <typename T>
+    [[nodiscard]] target make_target(T& dst) {
+        return { &dst, &ops_for<T>() };
+    }
+
+    [[noreturn]] inline void mismatch(std::string_view expected) {
+        throw std::invalid_argument { std::format("unexpected JSON value, expected {}", expected) };
+    }
+
+    template <scalar_type T>
+    void assign(T& dst, scalar_value val) {
+        std::visit([&dst]<typename V>(V v) {
+            if constexpr (std::same_as<V, std::nullptr_t>) {
+                /* Leave defaulted, same as a missing key */
+            } else if constexpr (std::same_as<T, bool>) {
+                if constexpr (std::same_as<V, bool>) {
+                    dst = v;
+                } else {
+                    mismatch("boolean");
+                }
+            } else if constexpr (std::integral<T>) {
+                if constexpr (std::same_as<V, int64_t> || std::same_as<V, uint64_t>) {
+                    dst = static_cast<T>(v);
+                } else {
+                    mismatch("integer");
+                }
+            } else if constexpr (std::floating_point<T>) {
+                if constexpr (std::same_as<V, int64_t> || std::same_as<V, uint64_t> || std::same_as<V, double>) {
+                    dst = static_cast<T>(v);
+                } else {
+                    mismatch("number");
+                }
+            } else if constexpr (std::same_as<T, std::string>) {
+                if constexpr (std::same_as<V, std::string*>) {
+                    dst = std::move(*v);
+                } else {
+                    mismatch("string");
+                }
+            } else if constexpr (std::same_as<T, timestamp>) {
+                if constexpr (std::same_as<V, std::string*>) {
+                    dst = parse_timestamp(*v);
+                } else {
+                    mismatch("timestamp");
+                }
+            } else {
+                /* Enums are sent either by name or by value */
+                std::optional<T> res;
+                if constexpr (std::same_as<V, std::string*>) {
+                    res = magic_enum::enum_cast<T>(*v);
+                } else if constexpr (std::same_as<V, int64_t> || std::same_as<V, uint64_t>) {
+                    res = magic_enum::enum_cast<T>(static_cast<std::underlying_type_t<T>>(v));
+                }
+
+                if (!res) {
+                    mismatch(magic_enum::enum_type_name<T>());
+                }
+
+                dst = *res;
+            }
+        }, val);
+    }
+
+    template <has_fields T>
+    [[nodiscard]] target find_member(T& dst, std::string_view key) {
+        static constexpr auto fields = fields_of<T>();
+
+        target res;
+        std::apply([&](const auto&... field) {
+            (void) ((field.name == key && (res = make_target(dst.*field.member), true)) || ...);
+        }, fields);
+
+        return res;
+    }
+
+    template <typename T>
+    [[nodiscard]] constexpr type_ops make_ops() {
+        type_ops res {
+            .scalar = [](void*, scalar_value) { mismatch("object or array"); },
+            .begin_object = [](void*) -> target { mismatch("scalar or array"); },
+            .begin_array = [](void*) -> target { mismatch("scalar or object"); },
+            .member = [](void*, std::string_view) -> target { return {}; },
+            .element = [](void*) -> target { return {}; },
+        };
+
+        if constexpr (scalar_type<T>) {
+            res.scalar = [](void* dst, scalar_value val) {
+                assign(*static_cast<T*>(dst), val);
+            };
+        } else if constexpr (has_fields<T>) {
+            res.scalar = [](void*, scalar_value val) {
+                if (!std::holds_alternative<std::nullptr_t>(val)) {
+                    mismatch("object");
+                }
+            };
+
+            res.begin_object = [](void* dst) -> target {
+                return make_target(*static_cast<T*>(dst));
+            };
+
+            res.member = [](void* dst, std::string_view key) {
+                return find_member(*static_cast<T*>(dst), key);
+            };
+        } else if constexpr (is_vector<T>::value) {
+            res.scalar = [](void*, scalar_value val) {
+                if (!std::holds_alternative<std::nullptr_t>(val)) {
+                    mismatch("array");
+                }
+            };
+
+            res.begin_array = [](void* dst) -> target {
+                return make_target(*static_cast<T*>(dst));
+            };
+
+            res.element = [](void* dst) {
+                return make_target(static_cast<T*>(dst)->emplace_back());
+            };
+        } else if constexpr (is_optional<T>::value) {
+            using value_type = T::value_type;
+
+            res.scalar = [](void* dst, scalar_value val) {
+                auto& opt = *static_cast<T*>(dst);
+                if (std::holds_alternative<std::nullptr_t>(val)) {
+                    opt.reset();
+                } else {
+                    ops_for<value_type>().scalar(&opt.emplace(), val);
+                }
+            };
+
+            res.begin_object = [](void* dst) {
+                return ops_for<value_type>().begin_object(&static_cast<T*>(dst)->emplace());
+            };
+
+            res.begin_array = [](void* dst) {
+                return ops_for<value_type>().begin_array(&static_cast<T*>(dst)->emplace());
+            };
+        }
+
+        return res;
+    }
+
+    template <typename T>
+    const type_ops& ops_for() {
+        static constexpr type_ops res = make_ops<T>();
+        return res;
+    }
+
+    /* nlohmann SAX interface */
+    class reader {
+        struct frame {
+            target dst;
+            bool is_array;
+        };
+
+        target _root;
+        target _next;
+        std::vector<frame> _stack;
+
+        /* Depth of the subtree being skipped, if any */
+        size_t _skip = 0;
+
+        /* Syntax error that stopped the parse, as its concrete type */
+        std::exception_ptr _error;
+
+        public:
+        using number_integer_t = nlohmann::json::number_integer_t;
+        using number_unsigned_t = nlohmann::json::number_unsigned_t;
+        using number_float_t = nlohmann::json::number_float_t;
+        using string_t = nlohmann::json::string_t;
+        using binary_t = nlohmann::json::binary_t;
+
+        explicit reader(target root);
+
+        bool null();
+        bool boolean(bool val);
+        bool number_integer(number_integer_t val);
+        bool number_unsigned(number_unsigned_t val);
+        bool number_float(number_float_t val, const string_t& str);
+        bool string(string_t& val);
+        bool binary(binary_t& val);
+
+        bool start_object(std::size_t elements);
+        bool key(string_t& val);
+        bool end_object();
+
+        bool start_array(std::size_t elements);
+        bool end_array();
+
+        bool parse_error(std::size_t position, const std::string& last_token, const nlohmann::json::exception& ex);
+
+        /* Throws the error that made sax_parse return false */
+        [[noreturn]] void rethrow() const;
+
+        private:
+        /* Target for the value that's about to start */
+        [[nodiscard]] target _value_target();
+
+        bool _scalar(scalar_value val);
+    };
+
+    /* Parse a whole response body into T */
+    template <readable T>
+    [[nodiscard]] T read(std::string_view text) {
+        T res {};
+        reader sax { make_target(res) };
+
+        if (!nlohmann::json::sax_parse(text, &sax)) {
+            sax.rethrow();
+        }
+
+        return res;
+    }
+}
+
+#endif /* JSON_READER_HPP */
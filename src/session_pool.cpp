@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "session_pool.hpp"
+
+#include <algorithm>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <logging.hpp>
+
+using namespace danbooru;
+
+namespace detail {
+    /* Only advertise what this libcurl can actually decode */
+    [[nodiscard]] static std::string supported_encodings() {
+        const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+
+        std::vector<std::string_view> res;
+        if (info->features & CURL_VERSION_ZSTD) {
+            res.emplace_back("zstd");
+        }
+
+        if (info->features & CURL_VERSION_BROTLI) {
+            res.emplace_back("br");
+        }
+
+        if (info->features & CURL_VERSION_LIBZ) {
+            res.emplace_back("gzip");
+            res.emplace_back("deflate");
+        }
+
+        return res | std::views::join_with(std::string_view { ", " }) | std::ranges::to<std::string>();
+    }
+}
+
+session_pool::lease::lease(session_pool* pool, session* ses)
+    : _pool { pool }, _session { ses } {
+
+}
+
+session_pool::lease::~lease() {
+    _release();
+}
+
+session_pool::lease::lease(lease&& other) noexcept
+    : _pool { std::exchange(other._pool, nullptr) }
+    , _session { std::exchange(other._session, nullptr) } {
+
+}
+
+session_pool::lease& session_pool::lease::operator=(lease&& other) noexcept {
+    if (this != &other) {
+        _release();
+        _pool = std::exchange(other._pool, nullptr);
+        _session = std::exchange(other._session, nullptr);
+    }
+
+    return *this;
+}
+
+cpr::Session* session_pool::lease::operator->() {
+    return &_session->ses;
+}
+
+cpr::Session& session_pool::lease::operator*() {
+    return _session->ses;
+}
+
+size_t session_pool::lease::id() const {
+    return _session->id;
+}
+
+uint64_t session_pool::lease::complete() {
+    long connects = 0;
+    curl_easy_getinfo(_session->ses.GetCurlHolder()->handle, CURLINFO_NUM_CONNECTS, &connects);
+
+    _session->requests.fetch_add(1, std::memory_order_relaxed);
+    _session->connects.fetch_add(connects, std::memory_order_relaxed);
+
+    return connects;
+}
+
+void session_pool::lease::_release() {
+    if (_pool && _session) {
+        _pool->_release(_session);
+    }
+
+    _pool = nullptr;
+    _session = nullptr;
+}
+
+session_pool::session_pool(cpr::Authentication auth, std::string user_agent, bool http2, bool compress)
+    : _auth { std::move(auth) }, _http2 { http2 }
+    , _encodings { compress ? detail::supported_encodings() : std::string {} }
+    , _user_agent { std::move(user_agent) } {
+
+    spdlog::info("Accepted encodings: {}", _encodings.empty() ? "identity" : _encodings);
+}
+
+session_pool::lease session_pool::acquire(bool with_body) {
+    std::unique_lock lock { _lock };
+
+    session* res;
+    if (auto it = std::ranges::find_if(_idle, [with_body](session* ses) { return with_body || !ses->has_body; }); it != _idle.end()) {
+        res = *it;
+        _idle.erase(it);
+    } else {
+        res = _sessions.emplace_back(std::make_unique<session>(_sessions.size())).get();
+        _configure(*res);
+
+        spdlog::debug("Opened session #{}", res->id);
+    }
+
+    if (res->generation != _generation) {
+        res->ses.SetUserAgent(_user_agent);
+        res->generation = _generation;
+    }
+
+    res->has_body |= with_body;
+
+    return lease { this, res };
+}
+
+void session_pool::set_user_agent(std::string user_agent) {
+    std::unique_lock lock { _lock };
+    _user_agent = std::move(user_agent);
+    ++_generation;
+}
+
+std::vector<session_pool::session_stats> session_pool::stats() {
+    std::unique_lock lock { _lock };
+
+    return _sessions
+        | std::views::transform([](const std::unique_ptr<session>& ses) {
+            return session_stats {
+                .id = ses->id,
+                .requests = ses->requests.load(std::memory_order_relaxed),
+                .connects = ses->connects.load(std::memory_order_relaxed),
+            };
+        })
+        | std::ranges::to<std::vector>();
+}
+
+void session_pool::_configure(session& ses) {
+    ses.ses.SetAuth(_auth);
+    ses.ses.SetUserAgent(_user_agent);
+    ses.generation = _generation;
+
+    if (_http2) {
+        /* Falls back to HTTP/1.1 if the server doesn't negotiate h2 */
+        ses.ses.SetHttpVersion(cpr::HttpVersion { cpr::HttpVersionCode::VERSION_2_0_TLS });
+    }
+
+    if (!_encodings.empty()) {
+        /* libcurl decodes the body as it arrives */
+        ses.ses.SetAcceptEncoding(cpr::AcceptEncoding { std::initializer_list<std::string> { _encodings } });
+    } else {
+        ses.ses.SetAcceptEncoding(cpr::AcceptEncoding { cpr::AcceptEncodingMethods::identity });
+    }
+
+    /* Keep idle connections from being dropped by middleboxes between batches */
+    CURL* handle = ses.ses.GetCurlHolder()->handle;
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 30L);
+}
+
+void session_pool::_release(session* ses) {
+    std::unique_lock lock { _lock };
+    _idle.push_back(ses);
+}
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef SESSION_POOL_HPP
+#define SESSION_POOL_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include <cpr/cpr.h>
+
+namespace danbooru {
+    /* Pool of long-lived sessions, so connections (and TLS sessions) are kept alive between requests */
+    class session_pool {
+        public:
+        struct session_stats {
+            size_t id;
+            uint64_t requests;
+
+            /* New connections opened, each of these is a full TCP + TLS handshake */
+            uint64_t connects;
+        };
+
+        private:
+        struct session {
+            size_t id;
+            cpr::Session ses;
+
+            /* User agent generation this session was configured with */
+            size_t generation = 0;
+
+            /* cpr can't turn a session with a body back into a plain GET */
+            bool has_body = false;
+
+            std::atomic<uint64_t> requests = 0;
+            std::atomic<uint64_t> connects = 0;
+
+            explicit session(size_t id) : id { id } { }
+        };
+
+        public:
+        /* Exclusive use of a session, returned to the pool on destruction */
+        class lease {
+            friend class session_pool;
+
+            session_pool* _pool;
+            session* _session;
+
+            lease(session_pool* pool, session* ses);
+
+            public:
+            ~lease();
+
+            lease(const lease&) = delete;
+            lease& operator=(const lease&) = delete;
+
+            lease(lease&& other) noexcept;
+            lease& operator=(lease&& other) noexcept;
+
+            cpr::Session* operator->();
+            cpr::Session& operator*();
+
+            [[nodiscard]] size_t id() const;
+
+            /* Record a finished transfer, returns the number of new connections it needed */
+            uint64_t complete();
+
+            private:
+            void _release();
+        };
+
+        private:
+        cpr::Authentication _auth;
+        bool _http2;
+
+        /* Accept-Encoding value, empty for uncompressed transfers */
+        std::string _encodings;
+
+        std::mutex _lock;
+        std::string _user_agent;
+        size_t _generation = 0;
+
+        std::vector<std::unique_ptr<session>> _sessions;
+        std::vector<session*> _idle;
+
+        public:
+        session_pool(cpr::Authentication auth, std::string user_agent, bool http2, bool compress);
+
+        session_pool(const session_pool&) = delete;
+        session_pool& operator=(const session_pool&) = delete;
+
+        /* Idle session, or a new one if none is available */
+        [[nodiscard]] lease acquire(bool with_body);
+
+        /* Applied to every session the next time it's acquired */
+        void set_user_agent(std::string user_agent);
+
+        [[nodiscard]] std::vector<session_stats> stats();
+
+        private:
+        void _configure(session& ses);
+        void _release(session* ses);
+    };
+}
+
+#endif /* SESSION_POOL_HPP */
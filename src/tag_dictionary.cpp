@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "tag_dictionary.hpp"
+
+#include <chrono>
+#include <mutex>
+
+#include <logging.hpp>
+
+using namespace database;
+
+void tag_dictionary::warm(connection& db) {
+    auto begin = std::chrono::steady_clock::now();
+
+    auto tx = db.work();
+
+    std::unique_lock lock { _lock };
+
+    _ids.reserve(tx.query_value<size_t>("SELECT COUNT(*) FROM tags"));
+
+    for (auto [id, name] : tx.stream<int32_t, std::string_view>("SELECT id, name FROM tags")) {
+        _insert(name, id);
+    }
+
+    tx.commit();
+
+    lock.unlock();
+
+    spdlog::info("Loaded {} tags in {}", _ids.size(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin));
+
+    log_memory();
+}
+
+tag_lookup tag_dictionary::find(const util::unordered_string_set& names) const {
+    tag_lookup res;
+    res.ids.reserve(names.size());
+
+    std::shared_lock lock { _lock };
+
+    for (std::string_view name : names) {
+        if (auto it = _ids.find(name); it != _ids.end()) {
+            res.ids.emplace(name, it->second);
+        } else {
+            res.missing.push_back(name);
+        }
+    }
+
+    return res;
+}
+
+void tag_dictionary::insert(const util::unordered_string_map<int32_t>& ids) {
+    std::unique_lock lock { _lock };
+
+    for (const auto& [name, id] : ids) {
+        _insert(name, id);
+    }
+}
+
+tag_dictionary::footprint tag_dictionary::memory() const {
+    std::shared_lock lock { _lock };
+
+    /* libstdc++ nodes hold the value, a next pointer and the cached hash */
+    size_t node = sizeof(decltype(_ids)::value_type) + sizeof(void*) + sizeof(size_t);
+
+    return {
+        .entries = _ids.size(),
+        .arena_reserved = _names.reserved(),
+        .arena_used = _names.used(),
+        .table = _ids.size() * node + _ids.bucket_count() * sizeof(void*),
+    };
+}
+
+void tag_dictionary::log_memory() const {
+    footprint mem = memory();
+
+    spdlog::info("Tag dictionary: {} tags, names {:.2f} / {:.2f} MiB, table {:.2f} MiB",
+        mem.entries,
+        mem.arena_used / 1048576.,
+        mem.arena_reserved / 1048576.,
+        mem.table / 1048576.
+    );
+}
+
+void tag_dictionary::_insert(std::string_view name, int32_t id) {
+    /* Existing names keep their interned copy, overwrites only change the ID */
+    if (auto it = _ids.find(name); it != _ids.end()) {
+        it->second = id;
+    } else {
+        _ids.emplace(_names.intern(name), id);
+    }
+}
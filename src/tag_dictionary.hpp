@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef TAG_DICTIONARY_HPP
+#define TAG_DICTIONARY_HPP
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include <util.hpp>
+#include <string_arena.hpp>
+
+#include "database.hpp"
+
+namespace database {
+    /* Tag name to ID for every tag in the database, shared by all tasks so resolving known tags needs no queries */
+    class tag_dictionary {
+        public:
+        struct footprint {
+            size_t entries;
+
+            /* Name storage, allocated and used */
+            size_t arena_reserved;
+            size_t arena_used;
+
+            /* Hash table nodes and buckets, estimated */
+            size_t table;
+        };
+
+        private:
+        mutable std::shared_mutex _lock;
+
+        util::string_arena _names;
+        std::unordered_map<std::string_view, int32_t, util::detail::string_hasher, util::detail::range_eq> _ids;
+
+        public:
+        tag_dictionary() = default;
+
+        tag_dictionary(const tag_dictionary&) = delete;
+        tag_dictionary& operator=(const tag_dictionary&) = delete;
+
+        /* Stream the whole tags table in */
+        void warm(connection& db);
+
+        /* Cached IDs, names not in the dictionary are listed as missing */
+        [[nodiscard]] tag_lookup find(const util::unordered_string_set& names) const;
+
+        /* Only add committed rows, a rolled back ID would stick around */
+        void insert(const util::unordered_string_map<int32_t>& ids);
+
+        [[nodiscard]] footprint memory() const;
+
+        void log_memory() const;
+
+        private:
+        void _insert(std::string_view name, int32_t id);
+    };
+}
+
+#endif /* TAG_DICTIONARY_HPP */
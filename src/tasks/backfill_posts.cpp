@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "backfill_posts.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <stop_token>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include <logging.hpp>
+#include <env.hpp>
+
+#include "post_batch.hpp"
+#include "fetch_posts.hpp"
+
+using namespace danbooru;
+using namespace database;
+
+namespace detail {
+    static constexpr std::string_view backfill_plan_key = "backfill_posts";
+
+    /* Posts in (cursor, end] are still to be fetched */
+    struct backfill_shard {
+        size_t index;
+        int32_t cursor;
+        int32_t end;
+
+        [[nodiscard]] std::string key() const {
+            return std::format("{}/{}", backfill_plan_key, index);
+        }
+
+        [[nodiscard]] json checkpoint() const {
+            return { { "cursor", cursor }, { "end", end } };
+        }
+    };
+
+    struct backfill_plan {
+        int32_t head;
+        std::vector<backfill_shard> shards;
+    };
+
+    /* Newest post on the site */
+    [[nodiscard]] static int32_t get_head(api& booru) {
+        auto posts = booru.fetch<std::vector<api_response::post>>("posts", { { "limit", 1 } }).get();
+
+        return posts.empty() ? 0 : posts.front().id;
+    }
+
+    /* Posts up to here are already stored, by fetch_posts or an earlier backfill */
+    [[nodiscard]] static int32_t get_synced(connection& db) {
+        auto tx = db.work();
+        std::optional cursor = db.cursor(tx, tasks::fetch_posts::cursor_key);
+        tx.commit();
+
+        return std::max(cursor.value_or(0), db.latest_post());
+    }
+
+    /* Load the existing plan, or split (synced, head] into evenly sized shards */
+    [[nodiscard]] static backfill_plan get_plan(api& booru, connection& db) {
+        int32_t synced = get_synced(db);
+
+        auto tx = db.work();
+
+        backfill_plan res;
+
+        if (std::optional plan = db.metadata(tx, backfill_plan_key)) {
+            int32_t head = plan->at("head");
+            size_t shards = plan->at("shards");
+
+            spdlog::info("Resuming backfill up to post #{} in {} shards", head, shards);
+
+            res.head = head;
+
+            for (size_t i = 0; i < shards; ++i) {
+                backfill_shard shard { .index = i, .cursor = 0, .end = 0 };
+
+                std::optional checkpoint = db.metadata(tx, shard.key());
+                if (!checkpoint) {
+                    throw std::runtime_error { std::format("Backfill shard {} has no checkpoint", i) };
+                }
+
+                shard.cursor = checkpoint->at("cursor");
+                shard.end = checkpoint->at("end");
+
+                res.shards.push_back(shard);
+            }
+        } else {
+            /* COPY fails on rows that already exist, only what's missing is planned */
+            int32_t head = std::max(get_head(booru), synced);
+            size_t shards = std::max<size_t>(util::environment::get_or_default<size_t>("BACKFILL_SHARDS", 4), 1);
+
+            spdlog::info("Planning backfill of posts ({}, {}] in {} shards", synced, head, shards);
+
+            res.head = head;
+
+            int32_t start = synced;
+            for (size_t i = 0; i < shards; ++i) {
+                int32_t end = static_cast<int32_t>(synced + static_cast<int64_t>(head - synced) * (i + 1) / shards);
+
+                backfill_shard shard { .index = i, .cursor = start, .end = end };
+                db.set_metadata(tx, shard.key(), shard.checkpoint());
+
+                res.shards.push_back(shard);
+
+                start = end;
+            }
+
+            db.set_metadata(tx, backfill_plan_key, { { "head", head }, { "shards", shards } });
+        }
+
+        tx.commit();
+
+        return res;
+    }
+
+    /* Hands over to fetch_posts, its cursor moves past everything backfilled in the transaction that drops the plan */
+    static void complete(connection& db, const backfill_plan& plan) {
+        auto tx = db.work();
+
+        for (const backfill_shard& shard : plan.shards) {
+            db.delete_metadata(tx, shard.key());
+        }
+
+        db.delete_metadata(tx, backfill_plan_key);
+
+        int32_t cursor = db.cursor(tx, tasks::fetch_posts::cursor_key).value_or(0);
+        db.set_cursor(tx, tasks::fetch_posts::cursor_key, std::max(cursor, plan.head));
+
+        tx.commit();
+
+        spdlog::info("Backfill complete up to post #{}", plan.head);
+    }
+
+    /* Returns whether the shard reached its end */
+    static bool run_shard(std::stop_token token, api& booru, tag_dictionary& dictionary, database::pool& pool, backfill_shard shard) {
+        /* Never starve the tasks following new posts */
+        priority_scope priority { request_priority::backfill };
+
+        spdlog::info("Shard {}: posts ({}, {}]", shard.index, shard.cursor, shard.end);
+
+        /* Pages per transaction, adapted to the measured commit time */
+        group_commit group;
+
+        while (!token.stop_requested() && shard.cursor < shard.end) {
+            auto begin = perpetual_task::clock::now();
+
+            /* Fetch the whole group first, no transaction stays open while waiting on the API */
+            backfill_shard next = shard;
+            std::vector<api_response::post> posts;
+            size_t pages = 0;
+
+            do {
+                auto page = fetch_sorted_posts(booru, next.cursor, next.end);
+                next.cursor = page.empty() ? next.end : page.back().id;
+
+                posts.insert(posts.end(), std::make_move_iterator(page.begin()), std::make_move_iterator(page.end()));
+                pages += 1;
+            } while (!token.stop_requested() && next.cursor < next.end && !group.full(pages, posts.size()));
+
+            auto db = pool.acquire();
+
+            auto rows = resolve_posts(booru, *db, dictionary, posts);
+
+            auto resolved = perpetual_task::clock::now();
+
+            /* The checkpoint commits together with the posts it covers */
+            auto tx = db->work();
+
+            insert_posts(*db, tx, rows);
+            db->set_metadata(tx, next.key(), next.checkpoint());
+
+            tx.commit();
+
+            auto committed = perpetual_task::clock::now();
+
+            shard = next;
+            group.record(committed - resolved);
+
+            spdlog::debug("Shard {}: inserted {} posts in {} pages, up to {} of {} ({})",
+                shard.index, posts.size(), pages, shard.cursor, shard.end, committed - begin);
+        }
+
+        if (shard.cursor < shard.end) {
+            return false;
+        }
+
+        spdlog::info("Shard {}: done", shard.index);
+        return true;
+    }
+}
+
+void tasks::backfill_posts::execute(std::stop_token token, api& booru, tag_dictionary& dictionary, database::pool& pool) {
+    detail::backfill_plan plan = detail::get_plan(booru, *pool.acquire());
+
+    /* A failing shard stops the others at their next checkpoint */
+    std::stop_source stop;
+    std::stop_callback forward { token, [&stop] { stop.request_stop(); } };
+
+    std::mutex error_lock;
+    std::exception_ptr error;
+
+    std::atomic<size_t> remaining = plan.shards.size();
+
+    /* All shards share the API's rate limiter and the connection pool, more of them only helps while both keep up */
+    std::vector<std::jthread> workers;
+    for (const detail::backfill_shard& shard : plan.shards) {
+        if (shard.cursor >= shard.end) {
+            remaining -= 1;
+            continue;
+        }
+
+        workers.emplace_back([&, shard] {
+            try {
+                if (detail::run_shard(stop.get_token(), booru, dictionary, pool, shard)) {
+                    remaining -= 1;
+                }
+            } catch (...) {
+                std::unique_lock lock { error_lock };
+                if (!error) {
+                    error = std::current_exception();
+                }
+
+                stop.request_stop();
+            }
+        });
+    }
+
+    bool ran = !workers.empty();
+    workers.clear();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    if (remaining == 0) {
+        detail::complete(*pool.acquire(), plan);
+    }
+
+    if (ran) {
+        booru.log_stats();
+        pool.log_stats();
+    }
+}
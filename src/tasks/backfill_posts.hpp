@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef BACKFILL_POSTS_HPP
+#define BACKFILL_POSTS_HPP
+
+#include "perpetual_task.hpp"
+#include "danbooru.hpp"
+#include "database.hpp"
+#include "database_pool.hpp"
+
+namespace tasks {
+    /* Crawls the posts missing up to the newest one at planning time, split into ID ranges fetched in parallel.
+     * Once done, fetch_posts carries on from there */
+    class backfill_posts : public shared_resource_task<danbooru::api&, database::tag_dictionary&, database::pool&> {
+        public:
+        using shared_resource_task::shared_resource_task;
+
+        protected:
+        void execute(std::stop_token token, danbooru::api& booru, database::tag_dictionary& dictionary, database::pool& pool) override;
+    };
+}
+
+#endif /* BACKFILL_POSTS_HPP */
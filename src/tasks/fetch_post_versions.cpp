@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "fetch_post_versions.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <ranges>
+
+#include <spdlog/spdlog.h>
+
+#include <logging.hpp>
+#include <util.hpp>
+#include <env.hpp>
+
+#include "tag_dictionary.hpp"
+
+using namespace danbooru;
+using namespace database;
+
+namespace detail {
+    /* Newest post version on the site */
+    [[nodiscard]] static int32_t get_head(api& booru) {
+        auto versions = booru.fetch<std::vector<api_response::post_version>>("post_versions", { { "limit", 1 } }).get();
+
+        return versions.empty() ? 0 : versions.front().id;
+    }
+
+    /* End of the range after start_at, one that size always fits in a single page */
+    [[nodiscard]] static int32_t range_end(int32_t start_at, int32_t head) {
+        return static_cast<int32_t>(std::min<int64_t>(static_cast<int64_t>(start_at) + static_cast<int64_t>(page_limit), head));
+    }
+
+    /* Versions with IDs in (start_at, end_at] */
+    [[nodiscard]] static std::future<std::vector<api_response::post_version>> fetch_range(api& booru, int32_t start_at, int32_t end_at) {
+        return booru.fetch<std::vector<api_response::post_version>>("post_versions",
+            {
+                { "limit", page_limit },
+                { "search", { { "id", std::format("{}..{}", start_at + 1, end_at) } } }
+            }
+        );
+    }
+
+    /* Translate tag names to IDs, fetching and inserting unknown tags */
+    [[nodiscard]] static std::vector<post_version> resolve_versions(api& booru, connection& db, tag_dictionary& dictionary,
+        std::span<const api_response::post_version> versions) {
+        util::unordered_string_set tags;
+        for (const api_response::post_version& version : versions) {
+            tags.insert(version.added_tags.begin(), version.added_tags.end());
+            tags.insert(version.removed_tags.begin(), version.removed_tags.end());
+        }
+
+        auto tag_ids = fetch_and_insert_tags(booru, db, dictionary, tags, insert_mode::overwrite).get();
+
+        auto to_ids = [&tag_ids](const std::vector<std::string>& names) {
+            return names
+                | std::views::transform([&tag_ids](const std::string& name) { return tag_ids.find(name)->second; })
+                | std::ranges::to<std::vector>();
+        };
+
+        return versions
+            | std::views::transform([&](const api_response::post_version& src) {
+                return post_version {
+                    .id           = src.id,
+                    .post_id      = src.post_id,
+
+                    /* Null for some automated edits, the column isn't nullable */
+                    .updater_id   = src.updater_id.value_or(0),
+                    .updated_at   = src.updated_at,
+                    .version      = src.version,
+                    .added_tags   = to_ids(src.added_tags),
+                    .removed_tags = to_ids(src.removed_tags),
+                    .new_rating   = src.rating_changed ? src.rating : std::nullopt,
+                    .new_parent   = src.parent_changed ? src.parent_id : std::nullopt,
+                    .new_source   = src.source_changed ? std::optional { src.source } : std::nullopt,
+                };
+            })
+            | std::ranges::to<std::vector>();
+    }
+}
+
+void tasks::fetch_post_versions::execute(std::stop_token token, api& booru, tag_dictionary& dictionary, database::pool& pool) {
+    /* History is catching up on changes, it may wait behind new posts */
+    priority_scope priority { request_priority::incremental };
+
+    int32_t latest_version = [&pool] {
+        auto db = pool.acquire();
+        auto tx = db->work();
+
+        std::optional cursor = db->cursor(tx, cursor_key);
+
+        tx.commit();
+
+        return cursor ? *cursor : db->latest_post_version();
+    }();
+
+    int32_t head = detail::get_head(booru);
+
+    spdlog::info("Post versions: ({}, {}]", latest_version, head);
+
+    /* Ranges requested ahead of the one being inserted, the executor's rate limit still applies to all of them */
+    size_t concurrency = std::max<size_t>(util::environment::get_or_default<size_t>("POST_VERSION_CONCURRENCY", 4), 1);
+
+    std::deque<std::future<std::vector<api_response::post_version>>> in_flight;
+    int32_t requested = latest_version;
+
+    auto fill = [&] {
+        while (in_flight.size() < concurrency && requested < head) {
+            int32_t end_at = detail::range_end(requested, head);
+            in_flight.push_back(detail::fetch_range(booru, requested, end_at));
+            requested = end_at;
+        }
+    };
+
+    size_t total = 0;
+
+    fill();
+    while (!token.stop_requested() && !in_flight.empty()) {
+        auto begin = perpetual_task::clock::now();
+
+        /* Ranges are inserted in order, so the cursor never skips one that failed */
+        auto versions = in_flight.front().get();
+        in_flight.pop_front();
+
+        int32_t end_at = detail::range_end(latest_version, head);
+
+        fill();
+
+        auto db = pool.acquire();
+
+        auto rows = detail::resolve_versions(booru, *db, dictionary, versions);
+
+        auto tx = db->work();
+
+        db->insert(tx, rows);
+        db->set_cursor(tx, cursor_key, end_at);
+
+        tx.commit();
+
+        latest_version = end_at;
+        total += rows.size();
+
+        auto elapsed = perpetual_task::clock::now() - begin;
+
+        spdlog::info("Inserted {} post versions, up to {} of {} ({})", rows.size(), latest_version, head, elapsed);
+    }
+
+    spdlog::info("Inserted {} post versions in total", total);
+}
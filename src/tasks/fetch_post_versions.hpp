@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef FETCH_POST_VERSIONS_HPP
+#define FETCH_POST_VERSIONS_HPP
+
+#include "perpetual_task.hpp"
+#include "danbooru.hpp"
+#include "database.hpp"
+#include "database_pool.hpp"
+
+namespace tasks {
+    /* Insert every post version newer than the newest one in the database */
+    class fetch_post_versions : public shared_resource_task<danbooru::api&, database::tag_dictionary&, database::pool&> {
+        public:
+        /* Metadata key of the newest post version inserted */
+        static constexpr std::string_view cursor_key = "fetch_post_versions";
+
+        using shared_resource_task::shared_resource_task;
+
+        protected:
+        void execute(std::stop_token token, danbooru::api& booru, database::tag_dictionary& dictionary, database::pool& pool) override;
+    };
+}
+
+#endif /* FETCH_POST_VERSIONS_HPP */
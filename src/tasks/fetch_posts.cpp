@@ -1,181 +1,322 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 #include "fetch_posts.hpp"
 
-#include <array>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <stdexcept>
+#include <thread>
+#include <stop_token>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
 #include <logging.hpp>
 #include <util.hpp>
+#include <env.hpp>
+#include <bounded_queue.hpp>
 
 #include "danbooru.hpp"
 #include "database.hpp"
+#include "post_batch.hpp"
 
 using namespace danbooru;
 using namespace database;
 
 namespace detail {
-    static constexpr std::string_view post_attributes_to_fetch =
-        "id,uploader_id,approver_id,tag_string,rating,parent_id,source,media_asset[id],fav_count,"
-        "has_children,up_score,down_score,is_pending,is_flagged,is_deleted,is_banned,pixiv_id,"
-        "bit_flags,last_commented_at,last_comment_bumped_at,last_noted_at,created_at,updated_at";
+    /* Transform workers finish out of order, the writer puts pages back in sequence */
+    struct fetched_page {
+        size_t sequence;
+        std::vector<api_response::post> posts;
+    };
+
+    struct resolved_page {
+        size_t sequence;
+        tasks::post_rows rows;
+    };
+
+    /* How often a fetcher waiting for room in the window checks for a stop */
+    static constexpr auto stop_poll = std::chrono::milliseconds(100);
+
+    static void log_queue(std::string_view name, const util::queue_stats& stats) {
+        spdlog::info("{} queue: {:.1f} of {} used on average, {} at most, full for {}, empty for {}",
+            name, stats.average_occupancy(), stats.capacity, stats.max_occupancy,
+            std::chrono::duration_cast<std::chrono::milliseconds>(stats.full),
+            std::chrono::duration_cast<std::chrono::milliseconds>(stats.empty)
+        );
+    }
+}
 
-    [[nodiscard]] static std::vector<api_response::post> get_sorted_posts(api& booru, int32_t start_at) {
-        std::vector<api_response::post> posts = booru.fetch("posts",
-            {
-                { "limit", post_limit },
-                { "page", page_selector::after(start_at).str() },
-                { "only", post_attributes_to_fetch }
-            }
-        ).get();
+void tasks::fetch_posts::execute(std::stop_token token, api& booru, tag_dictionary& dictionary, database::pool& pool) {
+    /* Following the latest posts is what users notice */
+    priority_scope priority { request_priority::realtime };
+
+    ingest_stats stats = ingest_posts(token, booru, dictionary, pool);
+
+    spdlog::info("{} posts in {} pages and {} commits, fetch: {}, resolve: {}, insert: {}, commit: {}",
+        stats.posts, stats.pages, stats.commits,
+        std::chrono::duration_cast<std::chrono::milliseconds>(stats.fetch),
+        std::chrono::duration_cast<std::chrono::milliseconds>(stats.resolve),
+        std::chrono::duration_cast<std::chrono::milliseconds>(stats.insert),
+        std::chrono::duration_cast<std::chrono::milliseconds>(stats.commit)
+    );
+
+    detail::log_queue("Fetched pages", stats.pages_queue);
+    detail::log_queue("Resolved pages", stats.rows_queue);
+
+    booru.log_stats();
+    dictionary.log_memory();
+    pool.log_stats();
+}
+
+tasks::ingest_stats tasks::ingest_posts(std::stop_token token, api& booru, tag_dictionary& dictionary, database::pool& pool) {
+    ingest_stats stats;
 
-        std::ranges::sort(posts, {}, [](const api_response::post& post) { return post.id; });
+    int32_t latest_post = [&pool] {
+        auto db = pool.acquire();
+        auto tx = db->work();
 
-        return posts;
+        std::optional cursor = db->cursor(tx, fetch_posts::cursor_key);
+
+        tx.commit();
+
+        /* Scan once when upgrading from a database without a cursor */
+        return cursor ? *cursor : db->latest_post();
+    }();
+
+    spdlog::info("Latest post: post #{}", latest_post);
+
+    if (pool.size() < 2) {
+        throw std::runtime_error { "Ingesting posts needs at least 2 database connections, one is kept by the writer" };
     }
 
-    [[nodiscard]] static std::string get_id_string(std::span<api_response::post> posts) {
-        /* Comma-separated list of IDs */
-        std::stringstream id_string_stream;
-        id_string_stream << posts.front().id;
-        for (const auto& post : posts) {
-            id_string_stream << ',' << post.id;
+    /* Pages fetched ahead of the transform stage */
+    size_t depth = std::max<size_t>(util::environment::get_or_default<size_t>("PREFETCH_DEPTH", 2), 1);
+
+    /* Each one holds a pooled connection while it resolves tags, the writer keeps one of its own */
+    size_t workers = std::clamp<size_t>(util::environment::get_or_default<size_t>("PIPELINE_WORKERS", 2), 1, pool.size() - 1);
+
+    /* fetch -> pages -> transform workers -> resolved -> writer */
+    util::bounded_queue<detail::fetched_page> pages { depth };
+    util::bounded_queue<detail::resolved_page> resolved { workers };
+
+    /* Pages per transaction, adapted to the measured commit time */
+    group_commit group;
+
+    /* Pages between being fetched and committed, also bounds what the writer holds back while reordering or grouping */
+    std::counting_semaphore<> window { static_cast<std::ptrdiff_t>(depth + 2 * workers + group.max_pages()) };
+
+    using clock = std::chrono::steady_clock;
+
+    /* A failing stage stops the others */
+    std::stop_source stop;
+    std::stop_callback forward { token, [&stop] { stop.request_stop(); } };
+    std::stop_callback close_queues { stop.get_token(), [&] {
+        pages.close();
+        resolved.close();
+    } };
+
+    std::mutex lock;
+    std::exception_ptr error;
+
+    auto fail = [&] {
+        {
+            std::unique_lock guard { lock };
+            if (!error) {
+                error = std::current_exception();
+            }
         }
 
-        return id_string_stream.str();
-    }
+        stop.request_stop();
+    };
 
-    [[nodiscard]] static std::vector<api_response::post_version> get_sorted_post_versions(api& booru, std::span<api_response::post> posts) {
-        std::string id_string = get_id_string(posts);
+    request_priority current = priority_scope::current();
 
-        std::vector<api_response::post_version> res;
+    /* The next cursor is known as soon as a page arrives, so fetching never waits for the database */
+    std::jthread fetcher { [&] {
+        priority_scope priority { current };
+
+        try {
+            int32_t cursor = latest_post;
+            for (size_t sequence = 0; !stop.stop_requested(); ++sequence) {
+                while (!window.try_acquire_for(detail::stop_poll)) {
+                    if (stop.stop_requested()) {
+                        break;
+                    }
+                }
+
+                if (stop.stop_requested()) {
+                    break;
+                }
+
+                auto begin = clock::now();
+
+                auto posts = fetch_sorted_posts(booru, cursor);
 
-        int32_t latest_id = 0;
-        for (;;) {
-            std::vector<api_response::post_version> versions = booru.fetch("post_versions",
                 {
-                    { "limit", page_limit },
-                    { "page", page_selector::after(latest_id).str() },
-                    { "search", { { "post_id", id_string } } }
+                    std::unique_lock guard { lock };
+                    stats.fetch += clock::now() - begin;
                 }
-            ).get();
 
-            if (versions.empty()) {
-                break;
-            }
+                if (posts.empty()) {
+                    break;
+                }
 
-            std::ranges::sort(versions, {}, [](const api_response::post_version& v) { return v.id; });
+                spdlog::debug("Posts: [{}, {}] ({})", posts.front().id, posts.back().id, posts.size());
 
-            latest_id = versions.back().id;
+                cursor = posts.back().id;
 
-            /* Move since we don't need the old vector anymore */
-            res.insert(res.end(), std::make_move_iterator(versions.begin()), std::make_move_iterator(versions.end()));
+                if (!pages.push({ sequence, std::move(posts) })) {
+                    break;
+                }
+            }
+        } catch (...) {
+            fail();
         }
 
-        return res;
-    }
+        pages.close();
+    } };
 
-    [[nodiscard]] static std::vector<std::string_view> get_unknown_tags(util::unordered_string_map<int32_t>& tag_ids, connection& db) {
-        auto tx = db.work();
+    std::atomic<size_t> running = workers;
 
-        std::vector<std::string_view> unknown_tags;
-        for (auto& [tag, id] : tag_ids) {
-            int32_t result = db.tag_id(tx, tag);
-            if (result) {
-                id = result;
-            } else {
-                unknown_tags.emplace_back(tag);
+    std::vector<std::jthread> transformers;
+    for (size_t i = 0; i < workers; ++i) {
+        transformers.emplace_back([&] {
+            priority_scope priority { current };
+
+            try {
+                while (std::optional page = pages.pop()) {
+                    auto begin = clock::now();
+
+                    post_rows rows;
+
+                    {
+                        /* Only held while there's database work to do */
+                        auto db = pool.acquire();
+                        rows = resolve_posts(booru, *db, dictionary, page->posts);
+                    }
+
+                    {
+                        std::unique_lock guard { lock };
+                        stats.resolve += clock::now() - begin;
+                    }
+
+                    if (!resolved.push({ page->sequence, std::move(rows) })) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                fail();
             }
-        }
-        tx.commit();
 
-        return unknown_tags;
+            /* The last worker out tells the writer nothing else is coming */
+            if (--running == 0) {
+                resolved.close();
+            }
+        });
     }
-}
 
-void tasks::fetch_posts::execute(std::stop_token token, api& booru, connection& db) {
-    int32_t latest_post = db.latest_post();
+    try {
+        /* Dedicated to writing for the whole run, it never queues behind the transform stage for a lease */
+        auto db = pool.acquire();
 
-    spdlog::info("Latest post: post #{}", latest_post);
+        std::map<size_t, post_rows> pending;
+        size_t next = 0;
 
-    while (!token.stop_requested()) {
-        auto begin = clock::now();
+        /* In-order pages waiting for the next commit */
+        post_rows batch;
+        size_t batch_pages = 0;
 
-        auto posts = detail::get_sorted_posts(booru, latest_post);
+        /* When the open group is committed even if it isn't full */
+        clock::time_point deadline;
 
-        if (posts.empty()) {
-            break;
-        }
+        auto flush = [&] {
+            int32_t last_post = batch.posts.back().id;
+
+            auto begin = clock::now();
+
+            /* One statement per table for the whole group, so tag rows are still locked in a single ordered pass */
+            auto tx = db->work();
+
+            insert_posts(*db, tx, batch);
+            db->set_cursor(tx, fetch_posts::cursor_key, last_post);
 
-        spdlog::debug("Posts: [{}, {}] ({})", posts.front().id, posts.back().id, posts.size());
+            auto inserted = clock::now();
 
-        size_t total_tags = 0;
-        util::unordered_string_set tags;
-        for (const api_response::post& post : posts) {
-            for (const auto& tag : post.tag_string | std::views::split(' ')) {
-                tags.emplace(std::string_view { tag.begin(), tag.end() });
-                ++total_tags;
+            tx.commit();
+
+            auto committed = clock::now();
+
+            /* Durable now, only from here on does the cursor count as advanced */
+            latest_post = last_post;
+            group.record(committed - begin);
+
+            {
+                std::unique_lock guard { lock };
+                stats.posts += batch.posts.size();
+                stats.pages += batch_pages;
+                stats.commits += 1;
+                stats.insert += inserted - begin;
+                stats.commit += committed - inserted;
             }
-        }
 
-        auto tag_ids = fetch_and_insert_tags(booru, db, tags, insert_mode::overwrite).get();
-        std::unordered_map<int32_t, int32_t> tag_counts;
-        for (const auto& [tag, id] : tag_ids) {
-            tag_counts.emplace(id, 0);
-        }
+            spdlog::info("Inserted {} new posts in {} pages, up to {} ({})", batch.posts.size(), batch_pages, latest_post, committed - begin);
+
+            window.release(static_cast<std::ptrdiff_t>(batch_pages));
+
+            batch = {};
+            batch_pages = 0;
+        };
+
+        for (;;) {
+            /* An open group waits for more pages until it's full or its deadline passes, an empty queue alone doesn't end it */
+            std::optional page = batch_pages ? resolved.pop_until(deadline) : resolved.pop();
+            if (!page) {
+                if (!batch_pages) {
+                    break;
+                }
 
-        spdlog::trace("Processed {} tags, {} unique tags", total_tags, tag_ids.size());
-
-        auto tx = db.work();
-
-        for (const api_response::post& src : posts) {
-            post res {
-                .id           = src.id,
-                .uploader_id  = src.uploader_id,
-                .approver_id  = src.approver_id,
-                .tags         = src.tag_string
-                                    | std::views::split(' ')
-                                    | std::views::transform([&tag_ids](const auto& tag) { return tag_ids.find(tag)->second; })
-                                    | std::ranges::to<std::vector>(),
-                .rating       = src.rating,
-                .parent       = src.parent_id,
-                .source       = src.source,
-                .media_asset  = src.media_asset.id,
-                .fav_count    = src.fav_count,
-                .has_children = src.has_children,
-                .up_score     = src.up_score,
-                .down_score   = src.down_score,
-                .is_pending   = src.is_pending,
-                .is_flagged   = src.is_flagged,
-                .is_deleted   = src.is_deleted,
-                .is_banned    = src.is_banned,
-                .pixiv_id     = src.pixiv_id,
-                .bit_flags    = src.bit_flags,
-                .last_comment = src.last_commented_at,
-                .last_bump    = src.last_comment_bumped_at,
-                .last_note    = src.last_noted_at,
-                .created_at   = src.created_at,
-                .updated_at   = src.updated_at,
-            };
-
-            for (int32_t tag : res.tags) {
-                tag_counts[tag] += 1;
+                flush();
+                continue;
             }
 
-            db.insert(tx, res);
-        }
+            pending.emplace(page->sequence, std::move(page->rows));
 
-        for (const auto& [tag_id, count] : tag_counts) {
-            db.increment_post_count(tx, tag_id, count);
-        }
+            for (auto it = pending.find(next); it != pending.end(); it = pending.find(++next)) {
+                if (!batch_pages) {
+                    deadline = clock::now() + group.target();
+                }
 
-        tx.commit();
+                batch.append(std::move(it->second));
+                batch_pages += 1;
 
-        latest_post = db.latest_post();
+                pending.erase(it);
 
-        auto elapsed = clock::now() - begin;
+                if (group.full(batch_pages, batch.posts.size())) {
+                    flush();
+                }
+            }
+        }
+    } catch (...) {
+        fail();
+    }
 
-        spdlog::info("Inserted {} new posts, up to {} ({})", posts.size(), latest_post, elapsed);
+    stop.request_stop();
+
+    fetcher.join();
+    transformers.clear();
+
+    if (error) {
+        std::rethrow_exception(error);
     }
+
+    stats.pages_queue = pages.stats();
+    stats.rows_queue = resolved.stats();
+
+    return stats;
 }
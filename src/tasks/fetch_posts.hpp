@@ -5,14 +5,22 @@
 #include "perpetual_task.hpp"
 #include "danbooru.hpp"
 #include "database.hpp"
+#include "database_pool.hpp"
+#include "post_batch.hpp"
 
 namespace tasks {
-    class fetch_posts : public shared_resource_task<danbooru::api&, store_invoke_resource<database::connection>> {
+    /* Insert every post newer than the newest one in the database */
+    ingest_stats ingest_posts(std::stop_token token, danbooru::api& booru, database::tag_dictionary& dictionary, database::pool& pool);
+
+    class fetch_posts : public shared_resource_task<danbooru::api&, database::tag_dictionary&, database::pool&> {
         public:
+        /* Metadata key of the newest post inserted */
+        static constexpr std::string_view cursor_key = "fetch_posts";
+
         using shared_resource_task::shared_resource_task;
 
         protected:
-        void execute(std::stop_token token, danbooru::api& booru, database::connection& db) override;
+        void execute(std::stop_token token, danbooru::api& booru, database::tag_dictionary& dictionary, database::pool& pool) override;
     };
 }
 
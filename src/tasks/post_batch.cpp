@@ -0,0 +1,313 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "post_batch.hpp"
+
+#include <array>
+#include <bit>
+#include <map>
+#include <ranges>
+#include <algorithm>
+
+#include <logging.hpp>
+#include <util.hpp>
+#include <env.hpp>
+
+using namespace danbooru;
+using namespace database;
+
+namespace detail {
+    class fnv1a {
+        static constexpr uint64_t offset_basis = 0xcbf2'9ce4'8422'2325;
+        static constexpr uint64_t prime = 0x100'0000'01b3;
+
+        uint64_t _state = offset_basis;
+
+        public:
+        template <typename T> requires std::is_integral_v<T> || std::is_enum_v<T>
+        void add(T val) {
+            auto bytes = std::bit_cast<std::array<std::byte, sizeof(T)>>(val);
+            for (std::byte b : bytes) {
+                _state = (_state ^ static_cast<uint8_t>(b)) * prime;
+            }
+        }
+
+        /* Length first, so adjacent strings can't shift into each other */
+        void add(std::string_view str) {
+            add(str.size());
+            for (char c : str) {
+                _state = (_state ^ static_cast<uint8_t>(c)) * prime;
+            }
+        }
+
+        void add(timestamp ts) {
+            add(std::chrono::floor<std::chrono::microseconds>(ts.time_since_epoch()).count());
+        }
+
+        void add(float val) {
+            add(std::bit_cast<uint32_t>(val));
+        }
+
+        template <typename T>
+        void add(std::span<const T> vals) {
+            add(vals.size());
+            for (const T& val : vals) {
+                add(val);
+            }
+        }
+
+        void add(const media_asset_variant& variant) {
+            add(std::string_view { variant.type });
+            add(variant.width);
+            add(variant.height);
+            add(variant.file_ext);
+        }
+
+        template <typename T>
+        void add(const std::optional<T>& val) {
+            add(val.has_value());
+            if (val) {
+                add(*val);
+            }
+        }
+
+        [[nodiscard]] uint64_t value() const {
+            return _state;
+        }
+    };
+}
+
+void tasks::post_rows::append(post_rows&& other) {
+    posts.insert(posts.end(), std::make_move_iterator(other.posts.begin()), std::make_move_iterator(other.posts.end()));
+    assets.insert(assets.end(), std::make_move_iterator(other.assets.begin()), std::make_move_iterator(other.assets.end()));
+}
+
+tasks::group_commit::group_commit()
+    : group_commit {
+        std::chrono::milliseconds(util::environment::get_or_default<int64_t>("COMMIT_TARGET_MS", 250)),
+        util::environment::get_or_default<size_t>("COMMIT_MAX_ROWS", 10000)
+    } {
+
+}
+
+tasks::group_commit::group_commit(duration target, size_t max_rows)
+    : _target { target }, _max_rows { std::max<size_t>(max_rows, 1) }, _max_pages { std::max<size_t>(_max_rows / post_limit, 1) } {
+
+}
+
+bool tasks::group_commit::full(size_t pages, size_t rows) const {
+    return pages >= _pages || rows >= _max_rows;
+}
+
+void tasks::group_commit::record(duration elapsed) {
+    /* Additive increase, multiplicative decrease */
+    if (elapsed > _target) {
+        _pages = std::max<size_t>(_pages / 2, 1);
+    } else {
+        _pages = std::min(_pages + 1, _max_pages);
+    }
+}
+
+size_t tasks::group_commit::pages() const {
+    return _pages;
+}
+
+size_t tasks::group_commit::max_pages() const {
+    return _max_pages;
+}
+
+tasks::group_commit::duration tasks::group_commit::target() const {
+    return _target;
+}
+
+std::vector<api_response::post> tasks::fetch_sorted_posts(api& booru, int32_t start_at, std::optional<int32_t> end_at) {
+    json params {
+        { "limit", post_limit },
+        { "page", page_selector::after(start_at).str() }
+    };
+
+    if (end_at) {
+        params["tags"] = std::format("id:..{}", *end_at);
+    }
+
+    std::vector<api_response::post> posts = booru.fetch<std::vector<api_response::post>>("posts", std::move(params)).get();
+
+    std::ranges::sort(posts, {}, [](const api_response::post& post) { return post.id; });
+
+    return posts;
+}
+
+tasks::post_rows tasks::resolve_posts(api& booru, connection& db, tag_dictionary& dictionary, std::span<const api_response::post> posts) {
+    size_t total_tags = 0;
+    util::unordered_string_set tags;
+    for (const api_response::post& post : posts) {
+        for (const auto& tag : post.tag_string | std::views::split(' ')) {
+            tags.emplace(std::string_view { tag.begin(), tag.end() });
+            ++total_tags;
+        }
+    }
+
+    auto tag_ids = fetch_and_insert_tags(booru, db, dictionary, tags, insert_mode::overwrite).get();
+
+    spdlog::trace("Processed {} tags, {} unique tags", total_tags, tag_ids.size());
+
+    post_rows res;
+    res.assets = posts
+        | std::views::transform(&api_response::post::media_asset)
+        | std::ranges::to<std::vector>();
+
+    res.posts = posts
+        | std::views::transform([&tag_ids](const api_response::post& src) {
+            return post {
+                .id           = src.id,
+                .uploader_id  = src.uploader_id,
+                .approver_id  = src.approver_id,
+                .tags         = src.tag_string
+                                    | std::views::split(' ')
+                                    | std::views::transform([&tag_ids](const auto& tag) { return tag_ids.find(tag)->second; })
+                                    | std::ranges::to<std::vector>(),
+                .rating       = src.rating,
+                .parent       = src.parent_id,
+                .source       = src.source,
+                .media_asset  = src.media_asset.id,
+                .fav_count    = src.fav_count,
+                .has_children = src.has_children,
+                .up_score     = src.up_score,
+                .down_score   = src.down_score,
+                .is_pending   = src.is_pending,
+                .is_flagged   = src.is_flagged,
+                .is_deleted   = src.is_deleted,
+                .is_banned    = src.is_banned,
+                .pixiv_id     = src.pixiv_id,
+                .bit_flags    = src.bit_flags,
+                .last_comment = src.last_commented_at,
+                .last_bump    = src.last_comment_bumped_at,
+                .last_note    = src.last_noted_at,
+                .created_at   = src.created_at,
+                .updated_at   = src.updated_at,
+            };
+        })
+        | std::ranges::to<std::vector>();
+
+    return res;
+}
+
+int64_t tasks::content_hash(const post& post, const media_asset& asset) {
+    detail::fnv1a hash;
+
+    hash.add(post.id);
+    hash.add(post.uploader_id);
+    hash.add(post.approver_id);
+    hash.add(std::span<const int32_t> { post.tags });
+    hash.add(post.rating);
+    hash.add(post.parent);
+    hash.add(std::string_view { post.source });
+    hash.add(post.media_asset);
+    hash.add(post.fav_count);
+    hash.add(post.has_children);
+    hash.add(post.up_score);
+    hash.add(post.down_score);
+    hash.add(post.is_pending);
+    hash.add(post.is_flagged);
+    hash.add(post.is_deleted);
+    hash.add(post.is_banned);
+    hash.add(post.pixiv_id);
+    hash.add(post.bit_flags);
+    hash.add(post.last_comment);
+    hash.add(post.last_bump);
+    hash.add(post.last_note);
+    hash.add(post.created_at);
+
+    hash.add(asset.id);
+    hash.add(std::string_view { asset.md5 });
+    hash.add(asset.file_ext);
+    hash.add(asset.file_size);
+    hash.add(asset.image_width);
+    hash.add(asset.image_height);
+    hash.add(asset.duration);
+    hash.add(std::string_view { asset.pixel_hash });
+    hash.add(asset.status);
+    hash.add(std::string_view { asset.file_key });
+    hash.add(asset.is_public);
+    hash.add(std::span<const media_asset_variant> { asset.variants });
+    hash.add(asset.created_at);
+
+    /* Stored in a BIGINT column */
+    return std::bit_cast<int64_t>(hash.value());
+}
+
+void tasks::insert_posts(connection& db, pqxx::work& tx, const post_rows& rows) {
+    std::map<int32_t, int32_t> tag_counts;
+
+    for (const post& post : rows.posts) {
+        for (int32_t tag : post.tags) {
+            tag_counts[tag] += 1;
+        }
+    }
+
+    /* Assets first, they're what the posts point at */
+    db.insert(tx, rows.assets);
+    db.insert(tx, rows.posts);
+
+    db.increment_post_counts(tx, tag_counts);
+
+    std::vector<int32_t> ids;
+    std::vector<int64_t> hashes;
+    for (size_t i = 0; i < rows.posts.size(); ++i) {
+        ids.push_back(rows.posts[i].id);
+        hashes.push_back(content_hash(rows.posts[i], rows.assets[i]));
+    }
+
+    db.set_post_hashes(tx, ids, hashes);
+}
+
+size_t tasks::upsert_posts(connection& db, pqxx::work& tx, const post_rows& rows) {
+    std::vector<int32_t> all_ids = rows.posts
+        | std::views::transform(&post::id)
+        | std::ranges::to<std::vector>();
+
+    auto stored = db.post_hashes(tx, all_ids);
+
+    /* Unchanged rows would cost a full rewrite, WAL and index updates for nothing */
+    std::vector<post> posts;
+    std::vector<media_asset> assets;
+    std::vector<int32_t> ids;
+    std::vector<int64_t> hashes;
+    for (size_t i = 0; i < rows.posts.size(); ++i) {
+        const post& post = rows.posts[i];
+        int64_t hash = content_hash(post, rows.assets[i]);
+
+        if (auto it = stored.find(post.id); it != stored.end() && it->second == hash) {
+            continue;
+        }
+
+        posts.push_back(post);
+        assets.push_back(rows.assets[i]);
+        ids.push_back(post.id);
+        hashes.push_back(hash);
+    }
+
+    size_t skipped = rows.posts.size() - posts.size();
+    if (posts.empty()) {
+        return skipped;
+    }
+
+    /* Start from minus what the old rows counted, then add the new ones back */
+    std::map<int32_t, int32_t> deltas;
+    for (const auto& [tag_id, count] : db.post_tag_counts(tx, ids)) {
+        deltas[tag_id] -= count;
+    }
+
+    for (const post& post : posts) {
+        for (int32_t tag : post.tags) {
+            deltas[tag] += 1;
+        }
+    }
+
+    std::erase_if(deltas, [](const auto& delta) { return delta.second == 0; });
+
+    db.upsert(tx, assets);
+    db.upsert(tx, posts);
+    db.increment_post_counts(tx, deltas);
+    db.set_post_hashes(tx, ids, hashes);
+
+    return skipped;
+}
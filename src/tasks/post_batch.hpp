@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef POST_BATCH_HPP
+#define POST_BATCH_HPP
+
+#include <chrono>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <bounded_queue.hpp>
+
+#include "danbooru.hpp"
+#include "database.hpp"
+#include "tag_dictionary.hpp"
+
+/* Steps shared by every task that ingests posts */
+namespace tasks {
+    /* Where the time of an ingest run went, stages run concurrently so their times overlap */
+    struct ingest_stats {
+        using duration = std::chrono::steady_clock::duration;
+
+        size_t posts = 0;
+        size_t pages = 0;
+
+        /* Fetching pages */
+        duration fetch = duration::zero();
+
+        /* Resolving tag names, including fetching unknown tags, summed over the transform workers */
+        duration resolve = duration::zero();
+
+        /* Inserting posts and post counts */
+        duration insert = duration::zero();
+
+        duration commit = duration::zero();
+
+        /* Transactions, each covering one or more pages */
+        size_t commits = 0;
+
+        /* Between fetching and the transform workers, and between those and the writer */
+        util::queue_stats pages_queue;
+        util::queue_stats rows_queue;
+    };
+
+    /* Database rows for a page of posts, assets[i] belongs to posts[i] */
+    struct post_rows {
+        std::vector<danbooru::post> posts;
+        std::vector<danbooru::media_asset> assets;
+
+        void append(post_rows&& other);
+    };
+
+    /* Pages per transaction, grown while commits stay under the target latency and halved when they don't */
+    class group_commit {
+        public:
+        using duration = std::chrono::steady_clock::duration;
+
+        private:
+        duration _target;
+        size_t _max_rows;
+        size_t _max_pages;
+        size_t _pages = 1;
+
+        public:
+        /* COMMIT_TARGET_MS and COMMIT_MAX_ROWS from the environment */
+        group_commit();
+        group_commit(duration target, size_t max_rows);
+
+        /* Whether a group this size should be committed now */
+        [[nodiscard]] bool full(size_t pages, size_t rows) const;
+
+        /* Writing and committing the last group took this long */
+        void record(duration elapsed);
+
+        [[nodiscard]] size_t pages() const;
+        [[nodiscard]] size_t max_pages() const;
+
+        /* Commit latency aimed for, also how long an open group waits for more pages */
+        [[nodiscard]] duration target() const;
+    };
+
+    /* Page of posts after start_at, up to and including end_at if given, sorted by ID */
+    [[nodiscard]] std::vector<danbooru::api_response::post> fetch_sorted_posts(
+        danbooru::api& booru, int32_t start_at, std::optional<int32_t> end_at = std::nullopt);
+
+    /* Resolve tag names, fetching and inserting unknown tags, and convert to database rows */
+    [[nodiscard]] post_rows resolve_posts(
+        danbooru::api& booru, database::connection& db, database::tag_dictionary& dictionary,
+        std::span<const danbooru::api_response::post> posts);
+
+    /* 64-bit FNV-1a over the stored columns of a post and its media asset, compared on re-sync to skip unchanged rows.
+     * Leaves out updated_at, every re-synced post has a new one. A skipped row keeps its old one, update_posts resumes
+     * from its own cursor rather than from the rows */
+    [[nodiscard]] int64_t content_hash(const danbooru::post& post, const danbooru::media_asset& asset);
+
+    /* Insert posts with their media assets and add them to their tags' post counts */
+    void insert_posts(database::connection& db, pqxx::work& tx, const post_rows& rows);
+
+    /* Insert or overwrite posts and media assets, post counts move by the difference between old and new tags.
+     * Posts whose content hash is unchanged are skipped, returns how many */
+    size_t upsert_posts(database::connection& db, pqxx::work& tx, const post_rows& rows);
+}
+
+#endif /* POST_BATCH_HPP */
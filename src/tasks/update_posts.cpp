@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "update_posts.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+
+#include <spdlog/spdlog.h>
+
+#include <logging.hpp>
+
+#include "fetch_posts.hpp"
+#include "post_batch.hpp"
+
+using namespace danbooru;
+using namespace database;
+
+namespace detail {
+    static constexpr std::string_view update_cursor_key = "update_posts";
+
+    /* Updates can share a timestamp, the ID breaks ties */
+    struct update_cursor {
+        timestamp updated_at;
+        int32_t id;
+
+        [[nodiscard]] json to_json() const {
+            return { { "updated_at", format_timestamp(updated_at) }, { "id", id } };
+        }
+
+        [[nodiscard]] static update_cursor from_json(const json& src) {
+            return { parse_timestamp(src.at("updated_at").get<std::string>()), src.at("id").get<int32_t>() };
+        }
+
+        [[nodiscard]] bool before(const api_response::post& post) const {
+            return std::tie(updated_at, id) < std::tie(post.updated_at, post.id);
+        }
+    };
+
+    [[nodiscard]] static update_cursor get_cursor(connection& db) {
+        auto tx = db.work();
+
+        update_cursor res;
+        if (std::optional data = db.metadata(tx, update_cursor_key)) {
+            res = update_cursor::from_json(*data);
+        } else {
+            /* Start at the newest change we already have, older ones are in the rows. Rows skipped as unchanged keep an
+             * older updated_at, that only makes the first scan start earlier */
+            res = { db.latest_post_update(tx).value_or(clock::now()), 0 };
+        }
+
+        tx.commit();
+
+        return res;
+    }
+
+    /* Which posts the next page is taken from */
+    enum class update_scan {
+        /* Updated at or after the cursor's timestamp */
+        from_timestamp,
+
+        /* Updated exactly at the cursor's timestamp, by ID, when a whole page shares it */
+        tied,
+
+        /* Updated after the cursor's timestamp, once its ties are all applied */
+        past_timestamp,
+    };
+
+    [[nodiscard]] static double percent(size_t part, size_t total) {
+        return total ? 100. * static_cast<double>(part) / static_cast<double>(total) : 0.;
+    }
+
+    /* Posts past the cursor, oldest change first */
+    [[nodiscard]] static std::vector<api_response::post> get_updated_posts(api& booru, const update_cursor& cursor, update_scan scan) {
+        json params;
+
+        if (scan == update_scan::tied) {
+            params = {
+                { "limit", post_limit },
+                { "page", page_selector::after(static_cast<uint32_t>(cursor.id)).str() },
+                { "search", { { "updated_at", format_timestamp(cursor.updated_at) } } }
+            };
+        } else {
+            params = {
+                { "limit", post_limit },
+                { "search", {
+                    { "updated_at", std::format("{}{}", scan == update_scan::past_timestamp ? ">" : ">=", format_timestamp(cursor.updated_at)) },
+                    { "order", "updated_at_asc" }
+                } }
+            };
+        }
+
+        std::vector<api_response::post> posts = booru.fetch<std::vector<api_response::post>>("posts", std::move(params)).get();
+
+        std::ranges::sort(posts, {}, [](const api_response::post& post) { return std::tie(post.updated_at, post.id); });
+
+        return posts;
+    }
+}
+
+void tasks::update_posts::execute(std::stop_token token, api& booru, tag_dictionary& dictionary, database::pool& pool) {
+    /* Behind new posts, ahead of backfills */
+    priority_scope priority { request_priority::incremental };
+
+    detail::update_cursor cursor = detail::get_cursor(*pool.acquire());
+
+    spdlog::info("Following updates since {} (post #{})", format_timestamp(cursor.updated_at), cursor.id);
+
+    size_t total = 0;
+    size_t skipped = 0;
+    detail::update_scan scan = detail::update_scan::from_timestamp;
+    while (!token.stop_requested()) {
+        auto begin = perpetual_task::clock::now();
+
+        auto posts = detail::get_updated_posts(booru, cursor, scan);
+        size_t fetched = posts.size();
+
+        /* The boundary timestamp is fetched again, drop what was already applied */
+        std::erase_if(posts, [&cursor](const api_response::post& post) { return !cursor.before(post); });
+
+        if (posts.empty()) {
+            if (scan == detail::update_scan::from_timestamp && fetched == post_limit) {
+                /* A full page sharing one timestamp, page through it by ID instead */
+                spdlog::debug("Page of updates made no progress, paging through {} by ID", format_timestamp(cursor.updated_at));
+                scan = detail::update_scan::tied;
+                continue;
+            }
+
+            if (scan == detail::update_scan::tied) {
+                scan = detail::update_scan::past_timestamp;
+                continue;
+            }
+
+            break;
+        }
+
+        auto db = pool.acquire();
+
+        /* Posts newer than fetch_posts' cursor are left to it, it would fail on rows that already exist */
+        int32_t inserted_up_to = [&] {
+            auto tx = db->work();
+            std::optional res = db->cursor(tx, fetch_posts::cursor_key);
+            tx.commit();
+
+            /* Same fallback as fetch_posts, before its first commit the stored posts are what it starts from */
+            return res ? *res : db->latest_post();
+        }();
+
+        /* Stop at the first of them rather than step over it, an edit made after fetch_posts downloaded it is picked up
+         * by a later scan once fetch_posts has caught up */
+        auto first_new = std::ranges::find_if(posts, [inserted_up_to](const api_response::post& post) { return post.id > inserted_up_to; });
+        bool caught_up = first_new == posts.end();
+
+        if (first_new == posts.begin()) {
+            spdlog::debug("Waiting for fetch_posts to insert post #{}", first_new->id);
+            break;
+        }
+
+        posts.erase(first_new, posts.end());
+
+        detail::update_cursor next { posts.back().updated_at, posts.back().id };
+
+        auto rows = resolve_posts(booru, *db, dictionary, posts);
+
+        auto tx = db->work();
+
+        size_t unchanged = upsert_posts(*db, tx, rows);
+        db->set_metadata(tx, detail::update_cursor_key, next.to_json());
+
+        tx.commit();
+
+        cursor = next;
+        total += rows.posts.size();
+        skipped += unchanged;
+
+        if (scan == detail::update_scan::tied) {
+            /* A short page is the last of the ties */
+            if (fetched < post_limit) {
+                scan = detail::update_scan::past_timestamp;
+            }
+        } else {
+            scan = detail::update_scan::from_timestamp;
+        }
+
+        auto elapsed = perpetual_task::clock::now() - begin;
+
+        spdlog::info("Updated {} posts, {} unchanged ({:.1f}% skipped), up to {} ({})",
+            rows.posts.size() - unchanged, unchanged, detail::percent(unchanged, rows.posts.size()),
+            format_timestamp(cursor.updated_at), elapsed);
+
+        if (!caught_up) {
+            break;
+        }
+    }
+
+    spdlog::info("Updated {} posts in total, {} unchanged ({:.1f}% skipped)",
+        total - skipped, skipped, detail::percent(skipped, total));
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef UPDATE_POSTS_HPP
+#define UPDATE_POSTS_HPP
+
+#include "perpetual_task.hpp"
+#include "danbooru.hpp"
+#include "database.hpp"
+#include "database_pool.hpp"
+
+namespace tasks {
+    /* Follows posts by last update and overwrites the rows that changed */
+    class update_posts : public shared_resource_task<danbooru::api&, database::tag_dictionary&, database::pool&> {
+        public:
+        using shared_resource_task::shared_resource_task;
+
+        protected:
+        void execute(std::stop_token token, danbooru::api& booru, database::tag_dictionary& dictionary, database::pool& pool) override;
+    };
+}
+
+#endif /* UPDATE_POSTS_HPP */
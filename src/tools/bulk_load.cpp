@@ -0,0 +1,211 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include <iostream>
+#include <format>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <optional>
+#include <vector>
+#include <string>
+#include <exception>
+
+#include <tclap/CmdLine.h>
+#include <pqxx/pqxx>
+#include <nlohmann/json.hpp>
+
+#include <env.hpp>
+
+namespace detail {
+    /* Metadata key holding the definitions of the dropped indexes until they're rebuilt */
+    static constexpr std::string_view deferred_key = "deferred_indexes";
+
+    struct deferred_index {
+        std::string name;
+        std::string table;
+        std::string definition;
+    };
+
+    /* Plain secondary indexes, whatever backs a primary key, unique or other constraint stays */
+    static constexpr pqxx::zview secondary_indexes_query =
+        "SELECT i.relname, t.relname, pg_get_indexdef(i.oid)"
+        "  FROM pg_index x"
+        "  JOIN pg_class i ON i.oid = x.indexrelid"
+        "  JOIN pg_class t ON t.oid = x.indrelid"
+        "  JOIN pg_namespace n ON n.oid = t.relnamespace"
+        "  WHERE n.nspname = current_schema()"
+        "    AND NOT x.indisunique AND NOT x.indisprimary"
+        "    AND NOT EXISTS (SELECT 1 FROM pg_constraint c WHERE c.conindid = i.oid)"
+        "  ORDER BY pg_relation_size(t.oid) DESC, i.relname";
+
+    [[nodiscard]] static double seconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    [[nodiscard]] static std::optional<nlohmann::json> get_deferred(pqxx::work& tx) {
+        auto rows = tx.exec_params("SELECT data FROM metadata WHERE key = $1", deferred_key);
+        if (rows.empty()) {
+            return std::nullopt;
+        }
+
+        return nlohmann::json::parse(rows.at(0).at(0).view());
+    }
+
+    static void defer(pqxx::connection& conn) {
+        pqxx::work tx { conn };
+
+        if (get_deferred(tx)) {
+            throw std::runtime_error { "Indexes are already deferred, rebuild them first" };
+        }
+
+        nlohmann::json indexes = nlohmann::json::array();
+        for (auto [name, table, definition] : tx.query<std::string, std::string, std::string>(secondary_indexes_query)) {
+            std::println("Dropping {} on {}", name, table);
+
+            tx.exec0(std::format("DROP INDEX {}", tx.quote_name(name)));
+            indexes.push_back({ { "name", name }, { "table", table }, { "definition", definition } });
+        }
+
+        /* The definitions commit together with the drops, so a failed run loses nothing */
+        tx.exec_params0(
+            "INSERT INTO metadata VALUES ($1, $2::jsonb)",
+            deferred_key, indexes.dump()
+        );
+
+        tx.commit();
+
+        std::println("Dropped {} indexes, rebuild them with --rebuild once the backfill is done", indexes.size());
+    }
+
+    static void rebuild(pqxx::connection& conn, size_t jobs, const std::string& work_mem, size_t parallel_workers) {
+        std::vector<deferred_index> indexes;
+
+        {
+            pqxx::work tx { conn };
+            std::optional deferred = get_deferred(tx);
+            tx.commit();
+
+            if (!deferred) {
+                std::println("No deferred indexes");
+                return;
+            }
+
+            for (const nlohmann::json& index : *deferred) {
+                indexes.push_back({ index.at("name"), index.at("table"), index.at("definition") });
+            }
+        }
+
+        /* Handed out in the order they were dropped, largest tables first so the long builds don't end up last */
+        std::atomic<size_t> next = 0;
+
+        std::mutex lock;
+        std::exception_ptr error;
+
+        auto begin = std::chrono::steady_clock::now();
+
+        {
+            std::vector<std::jthread> workers;
+            for (size_t i = 0; i < std::min(jobs, indexes.size()); ++i) {
+                workers.emplace_back([&] {
+                    try {
+                        pqxx::connection worker;
+                        worker.set_session_var("maintenance_work_mem", work_mem);
+                        worker.set_session_var("max_parallel_maintenance_workers", parallel_workers);
+
+                        for (size_t index = next++; index < indexes.size(); index = next++) {
+                            const deferred_index& src = indexes[index];
+
+                            /* Indexes from an interrupted rebuild may already be back */
+                            std::string definition = src.definition;
+                            if (definition.starts_with("CREATE INDEX ")) {
+                                definition.replace(0, 13, "CREATE INDEX IF NOT EXISTS ");
+                            }
+
+                            auto start = std::chrono::steady_clock::now();
+
+                            pqxx::nontransaction tx { worker };
+                            tx.exec0(definition);
+
+                            auto elapsed = std::chrono::steady_clock::now() - start;
+
+                            std::unique_lock output { lock };
+                            std::println("{:<48} {:<16} {:>8.1f} s", src.name, src.table, seconds(elapsed));
+                        }
+                    } catch (...) {
+                        std::unique_lock output { lock };
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+
+                        /* Let the other workers run dry */
+                        next = indexes.size();
+                    }
+                });
+            }
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+
+        pqxx::work tx { conn };
+        tx.exec_params0("DELETE FROM metadata WHERE key = $1", deferred_key);
+        tx.commit();
+
+        std::vector<std::string> tables;
+        for (const deferred_index& index : indexes) {
+            if (std::ranges::find(tables, index.table) == tables.end()) {
+                tables.push_back(index.table);
+            }
+        }
+
+        /* Fresh statistics, the planner hasn't seen any of the loaded rows yet */
+        for (const std::string& table : tables) {
+            pqxx::nontransaction analyze { conn };
+            analyze.exec0(std::format("ANALYZE {}", analyze.quote_name(table)));
+        }
+
+        std::println("Rebuilt {} indexes in {:.1f} s with {} jobs", indexes.size(), seconds(elapsed), jobs);
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        TCLAP::CmdLine cmd { "Drop secondary indexes before a bulk load and rebuild them afterwards" };
+
+        TCLAP::SwitchArg defer { "", "defer", "Drop every non-unique index, remembering its definition" };
+        TCLAP::SwitchArg rebuild { "", "rebuild", "Recreate the deferred indexes in parallel" };
+        cmd.xorAdd(defer, rebuild);
+
+        TCLAP::ValueArg<size_t> jobs { "j", "jobs", "Indexes built at the same time", false, 4, "COUNT" };
+        TCLAP::ValueArg<std::string> work_mem {
+            "", "maintenance-work-mem", "maintenance_work_mem of each job, used jobs times over", false, "1GB", "SIZE"
+        };
+        TCLAP::ValueArg<size_t> parallel_workers {
+            "", "parallel-workers", "max_parallel_maintenance_workers of each job", false, 2, "COUNT"
+        };
+
+        cmd.add(util::environment::arg());
+        cmd.add(jobs);
+        cmd.add(work_mem);
+        cmd.add(parallel_workers);
+        cmd.parse(argc, argv);
+        util::environment::parse();
+
+        pqxx::connection conn;
+
+        if (defer.getValue()) {
+            detail::defer(conn);
+        } else {
+            detail::rebuild(conn, std::max<size_t>(jobs.getValue(), 1), work_mem.getValue(), parallel_workers.getValue());
+        }
+
+    } catch (const std::exception& e) {
+        std::println(std::cerr, "Exception: {}", e.what());
+        return EXIT_FAILURE;
+    }
+}
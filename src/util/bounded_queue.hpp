@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <algorithm>
+#include <thread>
+
+namespace util {
+    /* How a queue between two pipeline stages was used */
+    struct queue_stats {
+        using duration = std::chrono::steady_clock::duration;
+
+        uint64_t pushes = 0;
+
+        /* Items already queued, summed over every push */
+        uint64_t occupancy = 0;
+        size_t max_occupancy = 0;
+        size_t capacity = 0;
+
+        /* Producers waiting on a full queue, the consumer is the bottleneck */
+        duration full = duration::zero();
+
+        /* Consumers waiting on an empty queue, the producer is the bottleneck */
+        duration empty = duration::zero();
+
+        [[nodiscard]] double average_occupancy() const {
+            return pushes ? static_cast<double>(occupancy) / static_cast<double>(pushes) : 0.;
+        }
+    };
+
+    /* Blocking FIFO with a fixed capacity, producers wait while it's full.
+     * A lock-free ring (Vyukov's bounded MPMC queue), only blocked threads sleep, on an atomic wait */
+    template <typename T>
+    class bounded_queue {
+        using clock_type = std::chrono::steady_clock;
+
+        /* Keeps the producer and consumer positions from sharing a cache line */
+        static constexpr size_t line_size = 64;
+
+        /* Atomics have no timed wait, pop_until checks this often */
+        static constexpr auto timed_poll = std::chrono::milliseconds(1);
+
+        struct cell {
+            /* pos when free for the push at pos, pos + 1 once filled for the pop at pos */
+            std::atomic<size_t> sequence;
+            std::optional<T> value;
+        };
+
+        size_t _capacity;
+        std::unique_ptr<cell[]> _cells;
+
+        alignas(line_size) std::atomic<size_t> _push_pos = 0;
+        alignas(line_size) std::atomic<size_t> _pop_pos = 0;
+
+        /* Bumped after every push or pop, and on close, blocked threads wait for them to change */
+        alignas(line_size) std::atomic<uint32_t> _pushed = 0;
+        alignas(line_size) std::atomic<uint32_t> _popped = 0;
+
+        std::atomic<bool> _closed = false;
+
+        std::atomic<uint64_t> _pushes = 0;
+        std::atomic<uint64_t> _occupancy = 0;
+        std::atomic<size_t> _max_occupancy = 0;
+        std::atomic<clock_type::rep> _full = 0;
+        std::atomic<clock_type::rep> _empty = 0;
+
+        public:
+        explicit bounded_queue(size_t capacity)
+            : _capacity { std::max<size_t>(capacity, 1) }, _cells { std::make_unique<cell[]>(_capacity) } {
+            for (size_t i = 0; i < _capacity; ++i) {
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bounded_queue(const bounded_queue&) = delete;
+        bounded_queue& operator=(const bounded_queue&) = delete;
+
+        /* Blocks while full, returns false if the queue was closed */
+        bool push(T item) {
+            std::optional<clock_type::time_point> waiting;
+
+            for (;;) {
+                uint32_t popped = _popped.load(std::memory_order_acquire);
+
+                if (_closed.load(std::memory_order_acquire)) {
+                    return false;
+                }
+
+                if (_try_push(item)) {
+                    break;
+                }
+
+                if (!waiting) {
+                    waiting = clock_type::now();
+                }
+
+                _popped.wait(popped, std::memory_order_acquire);
+            }
+
+            if (waiting) {
+                _full.fetch_add((clock_type::now() - *waiting).count(), std::memory_order_relaxed);
+            }
+
+            _pushed.fetch_add(1, std::memory_order_release);
+            _pushed.notify_all();
+
+            return true;
+        }
+
+        /* Blocks while empty, nullopt once closed and drained */
+        [[nodiscard]] std::optional<T> pop() {
+            std::optional<clock_type::time_point> waiting;
+            std::optional<T> res;
+
+            for (;;) {
+                uint32_t pushed = _pushed.load(std::memory_order_acquire);
+                bool closed = _closed.load(std::memory_order_acquire);
+
+                if ((res = _try_pop()) || closed) {
+                    break;
+                }
+
+                if (!waiting) {
+                    waiting = clock_type::now();
+                }
+
+                _pushed.wait(pushed, std::memory_order_acquire);
+            }
+
+            if (waiting) {
+                _empty.fetch_add((clock_type::now() - *waiting).count(), std::memory_order_relaxed);
+            }
+
+            if (res) {
+                _popped.fetch_add(1, std::memory_order_release);
+                _popped.notify_all();
+            }
+
+            return res;
+        }
+
+        /* Blocks while empty until deadline, nullopt on timeout or once closed and drained */
+        [[nodiscard]] std::optional<T> pop_until(clock_type::time_point deadline) {
+            std::optional<clock_type::time_point> waiting;
+            std::optional<T> res;
+
+            for (;;) {
+                bool closed = _closed.load(std::memory_order_acquire);
+
+                if ((res = _try_pop()) || closed) {
+                    break;
+                }
+
+                auto now = clock_type::now();
+                if (now >= deadline) {
+                    break;
+                }
+
+                if (!waiting) {
+                    waiting = now;
+                }
+
+                std::this_thread::sleep_for(std::min<clock_type::duration>(timed_poll, deadline - now));
+            }
+
+            if (waiting) {
+                _empty.fetch_add((clock_type::now() - *waiting).count(), std::memory_order_relaxed);
+            }
+
+            if (res) {
+                _popped.fetch_add(1, std::memory_order_release);
+                _popped.notify_all();
+            }
+
+            return res;
+        }
+
+        /* Wake up everyone, pushes fail from now on */
+        void close() {
+            _closed.store(true, std::memory_order_release);
+
+            _pushed.fetch_add(1, std::memory_order_release);
+            _popped.fetch_add(1, std::memory_order_release);
+            _pushed.notify_all();
+            _popped.notify_all();
+        }
+
+        /* Items queued right now, may be stale by the time it returns */
+        [[nodiscard]] size_t size() const {
+            size_t pushed = _push_pos.load(std::memory_order_relaxed);
+            size_t popped = _pop_pos.load(std::memory_order_relaxed);
+
+            return pushed > popped ? std::min(pushed - popped, _capacity) : 0;
+        }
+
+        [[nodiscard]] queue_stats stats() const {
+            return {
+                .pushes = _pushes.load(std::memory_order_relaxed),
+                .occupancy = _occupancy.load(std::memory_order_relaxed),
+                .max_occupancy = _max_occupancy.load(std::memory_order_relaxed),
+                .capacity = _capacity,
+                .full = clock_type::duration { _full.load(std::memory_order_relaxed) },
+                .empty = clock_type::duration { _empty.load(std::memory_order_relaxed) },
+            };
+        }
+
+        private:
+        bool _try_push(T& item) {
+            size_t pos = _push_pos.load(std::memory_order_relaxed);
+
+            for (;;) {
+                cell& dst = _cells[pos % _capacity];
+                size_t sequence = dst.sequence.load(std::memory_order_acquire);
+
+                if (sequence == pos) {
+                    if (_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        /* Counts the item being pushed */
+                        size_t queued = size();
+
+                        dst.value.emplace(std::move(item));
+                        dst.sequence.store(pos + 1, std::memory_order_release);
+
+                        _pushes.fetch_add(1, std::memory_order_relaxed);
+                        _occupancy.fetch_add(queued, std::memory_order_relaxed);
+
+                        size_t max = _max_occupancy.load(std::memory_order_relaxed);
+                        while (queued > max && !_max_occupancy.compare_exchange_weak(max, queued, std::memory_order_relaxed)) { }
+
+                        return true;
+                    }
+                } else if (sequence < pos) {
+                    /* Still holds the item from a lap ago */
+                    return false;
+                } else {
+                    pos = _push_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        [[nodiscard]] std::optional<T> _try_pop() {
+            size_t pos = _pop_pos.load(std::memory_order_relaxed);
+
+            for (;;) {
+                cell& src = _cells[pos % _capacity];
+                size_t sequence = src.sequence.load(std::memory_order_acquire);
+
+                if (sequence == pos + 1) {
+                    if (_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        std::optional<T> res = std::move(src.value);
+                        src.value.reset();
+                        src.sequence.store(pos + _capacity, std::memory_order_release);
+
+                        return res;
+                    }
+                } else if (sequence < pos + 1) {
+                    /* Not filled yet */
+                    return std::nullopt;
+                } else {
+                    pos = _pop_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+}
+
+#endif /* BOUNDED_QUEUE_HPP */
@@ -1,27 +1,58 @@
 #include "rate_limit.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace detail {
+    [[nodiscard]] static util::rate_limit::duration refill_interval(size_t bucket_size, util::rate_limit::duration refill_delay) {
+        if (bucket_size == 0) {
+            throw std::invalid_argument { "Rate limit bucket size must be at least 1" };
+        }
+
+        return refill_delay / bucket_size;
+    }
+}
+
 util::rate_limit::rate_limit(size_t bucket_size, duration refill_delay)
     : _bucket_size { bucket_size }, _refill_delay { refill_delay }
-    , _bucket { _bucket_size }, _last_refill { clock_type::now() } {
+    , _interval { detail::refill_interval(bucket_size, refill_delay) }, _tat { 0 } {
 
 }
 
 void util::rate_limit::acquire() {
-    std::unique_lock lock { _lock };
-    if (_bucket == 0) {
-        /* Empty bucket, sleep until refill */
-        duration elapsed = clock_type::now() - _last_refill;
-        if (elapsed < _refill_delay) {
-            std::this_thread::sleep_for(_refill_delay - elapsed);
+    for (duration wait; (wait = try_acquire()) > duration::zero();) {
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+util::rate_limit::duration util::rate_limit::try_acquire() {
+    duration::rep now = clock_type::now().time_since_epoch().count();
+    duration::rep tat = _tat.load(std::memory_order_relaxed);
+
+    for (;;) {
+        duration::rep next = std::max(tat, now) + _interval.count();
+
+        /* A full bucket is worth _refill_delay of arrivals */
+        duration::rep allowed_at = next - _refill_delay.count();
+        if (allowed_at > now) {
+            return duration { allowed_at - now };
         }
 
-        _bucket = _bucket_size - 1;
-        _last_refill = clock_type::now();
-    } else {
-        _bucket -= 1;
+        if (_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+            return duration::zero();
+        }
     }
 }
 
+void util::rate_limit::penalize(duration delay) {
+    /* Empty bucket, first token available after the delay */
+    duration::rep target = (clock_type::now() + delay + _refill_delay - _interval).time_since_epoch().count();
+    duration::rep tat = _tat.load(std::memory_order_relaxed);
+
+    while (tat < target && !_tat.compare_exchange_weak(tat, target, std::memory_order_relaxed)) { }
+}
+
 size_t util::rate_limit::bucket_size() const {
     return _bucket_size;
 }
@@ -1,12 +1,12 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
 #ifndef RATE_LIMIT_HPP
 #define RATE_LIMIT_HPP
 
 #include <atomic>
 #include <chrono>
-#include <mutex>
 
 namespace util {
-    /* Token bucket rate limiter */
+    /* Smooth token bucket rate limiter (GCRA), tokens refill continuously and nobody sleeps holding a lock */
     class rate_limit {
         public:
         using clock_type = std::chrono::steady_clock;
@@ -17,15 +17,23 @@ namespace util {
         size_t _bucket_size;
         duration _refill_delay;
 
-        std::mutex _lock;
-        size_t _bucket;
-        time_point _last_refill;
+        /* Time it takes to refill a single token */
+        duration _interval;
+
+        /* Theoretical arrival time of the next request, in ticks since the clock's epoch */
+        std::atomic<duration::rep> _tat;
 
         public:
         explicit rate_limit(size_t bucket_size, duration refill_delay);
 
         void acquire();
 
+        /* Take a token without blocking, returns how long until one is available otherwise */
+        [[nodiscard]] duration try_acquire();
+
+        /* Hand out no tokens for the given duration, e.g. after a 429 or Retry-After from the server */
+        void penalize(duration delay);
+
         [[nodiscard]] size_t bucket_size() const;
         [[nodiscard]] duration refill_delay() const;
     };
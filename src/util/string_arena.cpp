@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#include "string_arena.hpp"
+
+#include <algorithm>
+
+util::string_arena::string_arena(size_t block_size) : _block_size { block_size } {
+
+}
+
+std::string_view util::string_arena::intern(std::string_view str) {
+    if (str.size() > _left) {
+        /* Oversized strings get a block of their own */
+        size_t size = std::max(_block_size, str.size());
+
+        _next = _blocks.emplace_back(std::make_unique_for_overwrite<char[]>(size)).get();
+        _left = size;
+        _reserved += size;
+    }
+
+    std::string_view res { _next, str.size() };
+    std::ranges::copy(str, _next);
+
+    _next += str.size();
+    _left -= str.size();
+    _used += str.size();
+
+    return res;
+}
+
+size_t util::string_arena::used() const {
+    return _used;
+}
+
+size_t util::string_arena::reserved() const {
+    return _reserved;
+}
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+#ifndef STRING_ARENA_HPP
+#define STRING_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace util {
+    /* Append-only string storage, views stay valid for the arena's lifetime. Not synchronized */
+    class string_arena {
+        std::vector<std::unique_ptr<char[]>> _blocks;
+        size_t _block_size;
+
+        /* Free space left in the last block */
+        char* _next = nullptr;
+        size_t _left = 0;
+
+        size_t _used = 0;
+        size_t _reserved = 0;
+
+        public:
+        explicit string_arena(size_t block_size = 64 * 1024);
+
+        string_arena(const string_arena&) = delete;
+        string_arena& operator=(const string_arena&) = delete;
+
+        [[nodiscard]] std::string_view intern(std::string_view str);
+
+        /* Bytes handed out, and bytes allocated for them */
+        [[nodiscard]] size_t used() const;
+        [[nodiscard]] size_t reserved() const;
+    };
+}
+
+#endif /* STRING_ARENA_HPP */